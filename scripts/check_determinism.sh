@@ -0,0 +1,33 @@
+#!/bin/bash
+# Checks that splitting the erosion over threads changes nothing: every sample is run with
+# one thread and with several, for a few structuring elements, and the printed results and
+# annotated images must be byte for byte the same.
+
+cd "$(dirname "${BASH_SOURCE[0]}")/.."
+
+SAMPLE_PATH="samples"
+THREADS=(2 3 4 8)
+ELEMENTS=("diamond:3" "square:3" "square:9" "disc:7")
+
+make > /dev/null || exit 1
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+failed=0
+for element in "${ELEMENTS[@]}"; do
+    for input in "$SAMPLE_PATH"/*/*.bmp; do
+        bin/cell-counter "$input" "$scratch/serial.bmp" --element="$element" --threads 1 > "$scratch/serial.txt"
+        for threads in "${THREADS[@]}"; do
+            bin/cell-counter "$input" "$scratch/tiled.bmp" --element="$element" --threads "$threads" > "$scratch/tiled.txt"
+            if ! cmp -s "$scratch/serial.txt" "$scratch/tiled.txt" || ! cmp -s "$scratch/serial.bmp" "$scratch/tiled.bmp"; then
+                echo "Mismatch: $input --element=$element --threads $threads"
+                failed=1
+            fi
+        done
+    done
+done
+
+if [ $failed -eq 0 ]; then
+    echo "Results are the same for every thread count"
+fi
+exit $failed
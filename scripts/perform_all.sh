@@ -43,44 +43,6 @@ input_paths=(
     "$SAMPLE_PATH/impossible/5IMPOSSIBLE.bmp"
 )
 
-output_paths=(
-    "$OUTPUT_PATH/output_1EASY.bmp"
-    "$OUTPUT_PATH/output_2EASY.bmp"
-    "$OUTPUT_PATH/output_3EASY.bmp"
-    "$OUTPUT_PATH/output_4EASY.bmp"
-    "$OUTPUT_PATH/output_5EASY.bmp"
-    "$OUTPUT_PATH/output_6EASY.bmp"
-    "$OUTPUT_PATH/output_7EASY.bmp"
-    "$OUTPUT_PATH/output_8EASY.bmp"
-    "$OUTPUT_PATH/output_9EASY.bmp"
-    "$OUTPUT_PATH/output_10EASY.bmp"
-    "$OUTPUT_PATH/output_1MEDIUM.bmp"
-    "$OUTPUT_PATH/output_2MEDIUM.bmp"
-    "$OUTPUT_PATH/output_3MEDIUM.bmp"
-    "$OUTPUT_PATH/output_4MEDIUM.bmp"
-    "$OUTPUT_PATH/output_5MEDIUM.bmp"
-    "$OUTPUT_PATH/output_6MEDIUM.bmp"
-    "$OUTPUT_PATH/output_7MEDIUM.bmp"
-    "$OUTPUT_PATH/output_8MEDIUM.bmp"
-    "$OUTPUT_PATH/output_9MEDIUM.bmp"
-    "$OUTPUT_PATH/output_10MEDIUM.bmp"
-    "$OUTPUT_PATH/output_1HARD.bmp"
-    "$OUTPUT_PATH/output_2HARD.bmp"
-    "$OUTPUT_PATH/output_3HARD.bmp"
-    "$OUTPUT_PATH/output_4HARD.bmp"
-    "$OUTPUT_PATH/output_5HARD.bmp"
-    "$OUTPUT_PATH/output_6HARD.bmp"
-    "$OUTPUT_PATH/output_7HARD.bmp"
-    "$OUTPUT_PATH/output_8HARD.bmp"
-    "$OUTPUT_PATH/output_9HARD.bmp"
-    "$OUTPUT_PATH/output_10HARD.bmp"
-    "$OUTPUT_PATH/output_1IMPOSSIBLE.bmp"
-    "$OUTPUT_PATH/output_2IMPOSSIBLE.bmp"
-    "$OUTPUT_PATH/output_3IMPOSSIBLE.bmp"
-    "$OUTPUT_PATH/output_4IMPOSSIBLE.bmp"
-    "$OUTPUT_PATH/output_5IMPOSSIBLE.bmp"
-)
-
 # Ensures that output directory exists
 if [ ! -d "$OUTPUT_PATH" ]; then
     echo "Creating output directory..."
@@ -88,9 +50,7 @@ if [ ! -d "$OUTPUT_PATH" ]; then
 fi
 
 echo "Processing files..."
-for ((i=0; i<${#input_paths[@]}; i++)); do
-    echo "Processing: ${input_paths[i]} -> ${output_paths[i]}"
-    bin/cell-counter "${input_paths[i]}" "${output_paths[i]}"
-done
+# One process for all samples, annotated images are written as $OUTPUT_PATH/output_<name>.bmp
+bin/cell-counter --batch <(printf '%s\n' "${input_paths[@]}") "$OUTPUT_PATH"
 
 echo "Done!"
@@ -0,0 +1,178 @@
+#include "batch.h"
+#include "pipeline.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define LINE_BUFFER 4096
+
+typedef struct {
+    BatchList *list;
+    const char *output_dir;
+    Engine engine;
+    const StructuringElement *element;
+    const ReportOptions *report_options;
+    atomic_int next;
+    atomic_int failed;
+} WorkQueue;
+
+static int add_path(BatchList *list, const char *path) {
+    if (list->amount == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        char **grown = realloc(list->paths, capacity * sizeof(char *));
+        if (!grown) return 0;
+        list->paths = grown;
+        list->capacity = capacity;
+    }
+    list->paths[list->amount] = strdup(path);
+    if (!list->paths[list->amount]) return 0;
+    list->amount++;
+    return 1;
+}
+
+static int has_bmp_extension(const char *name) {
+    size_t length = strlen(name);
+    return length > 4 && (strcmp(name + length - 4, ".bmp") == 0 || strcmp(name + length - 4, ".BMP") == 0);
+}
+
+static int compare_paths(const void *a, const void *b) { return strcmp(*(char *const *)a, *(char *const *)b); }
+
+static int collect_directory(const char *directory, BatchList *list) {
+    DIR *dir = opendir(directory);
+    if (!dir) {
+        perror("Error opening batch directory");
+        return 0;
+    }
+
+    struct dirent *entry;
+    char path[LINE_BUFFER];
+    while ((entry = readdir(dir)) != NULL) {
+        if (!has_bmp_extension(entry->d_name)) continue;
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        if (!add_path(list, path)) {
+            closedir(dir);
+            return 0;
+        }
+    }
+    closedir(dir);
+
+    // readdir order is arbitrary, sort so runs are reproducible
+    qsort(list->paths, list->amount, sizeof(char *), compare_paths);
+    return 1;
+}
+
+static int collect_list_file(const char *list_file, BatchList *list) {
+    FILE *fp = fopen(list_file, "r");
+    if (!fp) {
+        perror("Error opening batch list");
+        return 0;
+    }
+
+    char line[LINE_BUFFER];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (!add_path(list, line)) {
+            fclose(fp);
+            return 0;
+        }
+    }
+    fclose(fp);
+    return 1;
+}
+
+int batch_collect(const char *source, BatchList *list) {
+    struct stat source_stat;
+    if (stat(source, &source_stat) != 0) {
+        perror("Error reading batch source");
+        return 0;
+    }
+    if (S_ISDIR(source_stat.st_mode)) {
+        return collect_directory(source, list);
+    }
+    return collect_list_file(source, list);
+}
+
+void batch_free(BatchList *list) {
+    for (int i = 0; i < list->amount; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    list->paths = NULL;
+    list->amount = 0;
+    list->capacity = 0;
+}
+
+void batch_output_path(const char *input_path, const char *output_dir, char *buffer, size_t size) {
+    const char *name = strrchr(input_path, '/');
+    name = name ? name + 1 : input_path;
+    snprintf(buffer, size, "%s/output_%s", output_dir, name);
+}
+
+// 0 when every image was counted, otherwise 1 after a summary of the failures
+static int batch_status(WorkQueue *queue) {
+    int failed = atomic_load(&queue->failed);
+    if (failed == 0) return 0;
+    fprintf(stderr, "[ERROR] %d of %d images could not be read\n", failed, queue->list->amount);
+    return 1;
+}
+
+static void *batch_worker(void *argument) {
+    WorkQueue *queue = argument;
+    Pipeline pipeline = {.engine = queue->engine, .element = *queue->element};
+    char output_path[LINE_BUFFER];
+
+    int i;
+    while ((i = atomic_fetch_add(&queue->next, 1)) < queue->list->amount) {
+        char *input_path = queue->list->paths[i];
+        if (queue->output_dir) {
+            batch_output_path(input_path, queue->output_dir, output_path, sizeof(output_path));
+        }
+        // An image that can not be read is reported and skipped, the rest of the list goes on
+        if (count_cells(&pipeline, input_path, queue->output_dir ? output_path : NULL, queue->report_options) < 0) {
+            atomic_fetch_add(&queue->failed, 1);
+        }
+    }
+
+    pipeline_free(&pipeline);
+    return NULL;
+}
+
+int batch_run(BatchList *list, const char *output_dir, int threads, Engine engine, const StructuringElement *element,
+              const ReportOptions *report_options) {
+    WorkQueue queue = {.list = list, .output_dir = output_dir, .engine = engine, .element = element, .report_options = report_options};
+    atomic_init(&queue.next, 0);
+    atomic_init(&queue.failed, 0);
+
+    if (threads > list->amount) threads = list->amount;
+    if (threads <= 1) {
+        batch_worker(&queue);
+        return batch_status(&queue);
+    }
+
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    if (!workers) return 1;
+
+    int started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, batch_worker, &queue) != 0) {
+            // Whatever did start still drains the queue
+            fprintf(stderr, "[ERROR] Could only start %d of %d worker threads\n", started, threads);
+            break;
+        }
+    }
+    if (started == 0) {
+        batch_worker(&queue);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    return batch_status(&queue);
+}
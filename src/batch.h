@@ -0,0 +1,32 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "pipeline.h"
+
+#include <stddef.h>
+
+// Input images for a batch run, in processing order
+typedef struct {
+    char **paths;
+    int amount;
+    int capacity;
+} BatchList;
+
+// Collects the .bmp files in a directory, or the paths listed one per line in a list file.
+// Blank lines and lines starting with '#' in a list file are skipped. Returns 0 on failure.
+int batch_collect(const char *source, BatchList *list);
+
+void batch_free(BatchList *list);
+
+// Builds "<output_dir>/output_<input file name>"
+void batch_output_path(const char *input_path, const char *output_dir, char *buffer, size_t size);
+
+// Counts cells in every image of the list on a pool of worker threads. Workers pull the
+// next image from a shared queue and keep their own Pipeline for the whole run.
+// output_dir may be NULL. Each image's report is written whole, in the order images finish.
+// An image that can not be read is reported on stderr and skipped. Returns 0 when every image
+// was counted, 1 otherwise.
+int batch_run(BatchList *list, const char *output_dir, int threads, Engine engine, const StructuringElement *element,
+              const ReportOptions *report_options);
+
+#endif
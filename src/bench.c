@@ -0,0 +1,257 @@
+#include "batch.h"
+#include "pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Benchmark over the samples corpus: every image is opened once and kept in memory, then each
+// stage of the pipeline is timed separately, iterations times per image. The timings are
+// reported per tier as min/median/p99, along with the throughput of whole runs.
+
+#define DEFAULT_ITERATIONS 10
+#define PATH_BUFFER 4096
+
+static const char *TIERS[] = {"easy", "medium", "hard", "impossible"};
+#define TIERS_AMOUNT (int)(sizeof(TIERS) / sizeof(TIERS[0]))
+
+typedef enum {
+    STAGE_DECODE,
+    STAGE_THRESHOLD,
+    STAGE_SEGMENT,
+    STAGE_ANNOTATE,
+    STAGE_ENCODE,
+    STAGE_TOTAL,
+    STAGES_AMOUNT,
+} Stage;
+
+static const char *STAGE_NAMES[] = {"decode", "threshold", "segment", "annotate", "encode", "total"};
+
+// Timings of one tier, samples_amount per stage in milliseconds
+typedef struct {
+    const char *name;
+    int images;
+    double bytes;
+    double *samples[STAGES_AMOUNT];
+    int samples_amount;
+} TierResult;
+
+typedef struct {
+    double min;
+    double median;
+    double p99;
+} Summary;
+
+static void usage(char *program) {
+    fprintf(stderr, "Usage: %s [samples directory] [--iterations N] [--format=json|csv] [--engine=erode|watershed] [--element=SHAPE[:SIZE]]\n",
+            program);
+    fprintf(stderr, "       %*s [--threads N]\n", (int)strlen(program), "");
+    exit(1);
+}
+
+static double now_ms(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1e6;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentiles; sorts samples
+static Summary summarise(double *samples, int amount) {
+    qsort(samples, amount, sizeof(double), compare_doubles);
+    Summary summary = {samples[0], samples[(amount - 1) / 2], samples[(99 * amount + 99) / 100 - 1]};
+    return summary;
+}
+
+// Runs every stage on one image and adds the timings to result unless this is a warm-up run
+static void run_image(Pipeline *pipeline, BMP *bmp, TierResult *result, int record) {
+    double times[STAGES_AMOUNT];
+    times[STAGE_DECODE] = now_ms();
+    pipeline_decode(pipeline, bmp);
+    times[STAGE_THRESHOLD] = now_ms();
+    unsigned int threshold = pipeline_threshold(pipeline);
+    times[STAGE_SEGMENT] = now_ms();
+    pipeline_segment(pipeline, threshold);
+    times[STAGE_ANNOTATE] = now_ms();
+    pipeline_annotate(pipeline);
+    times[STAGE_ENCODE] = now_ms();
+    encode_painted_bitmap(bmp, pipeline->paint);
+    times[STAGE_TOTAL] = now_ms();
+
+    if (record) {
+        for (int stage = 0; stage < STAGE_TOTAL; ++stage) {
+            result->samples[stage][result->samples_amount] = times[stage + 1] - times[stage];
+        }
+        result->samples[STAGE_TOTAL][result->samples_amount] = times[STAGE_TOTAL] - times[STAGE_DECODE];
+        result->samples_amount++;
+    }
+}
+
+// Opens every image of the tier, then runs them iterations times after one warm-up run each
+static int run_tier(Pipeline *pipeline, const char *directory, int iterations, TierResult *result) {
+    BatchList list = {0};
+    if (!batch_collect(directory, &list)) return 0;
+    if (list.amount == 0) {
+        fprintf(stderr, "[ERROR] No images in %s\n", directory);
+        batch_free(&list);
+        return 0;
+    }
+
+    BMP **bitmaps = malloc(list.amount * sizeof(BMP *));
+    int allocated = bitmaps != NULL;
+    for (int stage = 0; stage < STAGES_AMOUNT; ++stage) {
+        result->samples[stage] = malloc((size_t)list.amount * iterations * sizeof(double));
+        allocated &= result->samples[stage] != NULL;
+    }
+    if (!allocated) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for the benchmark\n");
+        exit(1);
+    }
+    result->images = list.amount;
+    for (int i = 0; i < list.amount; ++i) {
+        struct stat file_stat;
+        bitmaps[i] = open_bitmap(list.paths[i]);
+        if (!bitmaps[i]) exit(1);
+        if (stat(list.paths[i], &file_stat) == 0) result->bytes += file_stat.st_size;
+        run_image(pipeline, bitmaps[i], result, FALSE);
+    }
+
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        for (int i = 0; i < list.amount; ++i) {
+            run_image(pipeline, bitmaps[i], result, TRUE);
+        }
+    }
+
+    for (int i = 0; i < list.amount; ++i) {
+        bclose(bitmaps[i]);
+    }
+    free(bitmaps);
+    batch_free(&list);
+    return 1;
+}
+
+// Whole runs per second and input megabytes per second, from the summed total times
+static void throughput(const TierResult *result, int iterations, double *images_per_second, double *megabytes_per_second) {
+    double total_ms = 0;
+    for (int i = 0; i < result->samples_amount; ++i) {
+        total_ms += result->samples[STAGE_TOTAL][i];
+    }
+    *images_per_second = result->samples_amount / (total_ms / 1000.0);
+    *megabytes_per_second = result->bytes * iterations / 1e6 / (total_ms / 1000.0);
+}
+
+static void print_json(TierResult *results, int iterations, const char *engine, const char *element, int threads) {
+    printf("{\n  \"iterations\": %d,\n  \"engine\": \"%s\",\n  \"element\": \"%s\",\n  \"threads\": %d,\n  \"tiers\": [\n", iterations, engine,
+           element, threads);
+    for (int t = 0; t < TIERS_AMOUNT; ++t) {
+        TierResult *result = &results[t];
+        double images_per_second, megabytes_per_second;
+        throughput(result, iterations, &images_per_second, &megabytes_per_second);
+        printf("    {\n      \"tier\": \"%s\",\n      \"images\": %d,\n      \"images_per_sec\": %.2f,\n      \"mb_per_sec\": %.2f,\n", result->name,
+               result->images, images_per_second, megabytes_per_second);
+        printf("      \"stages\": {\n");
+        for (int stage = 0; stage < STAGES_AMOUNT; ++stage) {
+            Summary summary = summarise(result->samples[stage], result->samples_amount);
+            printf("        \"%s\": {\"min_ms\": %.4f, \"median_ms\": %.4f, \"p99_ms\": %.4f}%s\n", STAGE_NAMES[stage], summary.min, summary.median,
+                   summary.p99, stage + 1 < STAGES_AMOUNT ? "," : "");
+        }
+        printf("      }\n    }%s\n", t + 1 < TIERS_AMOUNT ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+// One row per tier and stage; the throughput columns are only filled in on the total rows
+static void print_csv(TierResult *results, int iterations, const char *engine, const char *element, int threads) {
+    printf("engine,element,threads,iterations,tier,stage,samples,min_ms,median_ms,p99_ms,images_per_sec,mb_per_sec\n");
+    for (int t = 0; t < TIERS_AMOUNT; ++t) {
+        TierResult *result = &results[t];
+        double images_per_second, megabytes_per_second;
+        throughput(result, iterations, &images_per_second, &megabytes_per_second);
+        for (int stage = 0; stage < STAGES_AMOUNT; ++stage) {
+            Summary summary = summarise(result->samples[stage], result->samples_amount);
+            printf("%s,%s,%d,%d,%s,%s,%d,%.4f,%.4f,%.4f,", engine, element, threads, iterations, result->name, STAGE_NAMES[stage],
+                   result->samples_amount, summary.min, summary.median, summary.p99);
+            if (stage == STAGE_TOTAL) {
+                printf("%.2f,%.2f\n", images_per_second, megabytes_per_second);
+            } else {
+                printf(",\n");
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *samples = "samples";
+    int iterations = DEFAULT_ITERATIONS;
+    int threads = 1;
+    ReportFormat format = FORMAT_JSON;
+    Engine engine = ENGINE_ERODE;
+    const char *element_spec = "diamond:3";
+    StructuringElement element;
+    element_build(SHAPE_DIAMOND, 3, &element);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+            if (iterations <= 0) usage(argv[0]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--format=json") == 0) {
+            format = FORMAT_JSON;
+        } else if (strcmp(argv[i], "--format=csv") == 0) {
+            format = FORMAT_CSV;
+        } else if (strcmp(argv[i], "--engine=erode") == 0) {
+            engine = ENGINE_ERODE;
+        } else if (strcmp(argv[i], "--engine=watershed") == 0) {
+            engine = ENGINE_WATERSHED;
+        } else if (strncmp(argv[i], "--element=", 10) == 0) {
+            element_spec = argv[i] + 10;
+            if (!element_parse(element_spec, &element)) usage(argv[0]);
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            usage(argv[0]);
+        } else {
+            samples = argv[i];
+        }
+    }
+
+    Pipeline pipeline = {.engine = engine, .element = element};
+    if (threads > 1) {
+        pipeline.pool = tile_pool_start(threads);
+        if (!pipeline.pool) return 1;
+    }
+
+    TierResult results[TIERS_AMOUNT] = {{0}};
+    for (int t = 0; t < TIERS_AMOUNT; ++t) {
+        char directory[PATH_BUFFER];
+        snprintf(directory, sizeof(directory), "%s/%s", samples, TIERS[t]);
+        results[t].name = TIERS[t];
+        fprintf(stderr, "[ %-5s ] Benchmarking %s\n", "LOG", directory);
+        if (!run_tier(&pipeline, directory, iterations, &results[t])) return 1;
+    }
+
+    const char *engine_name = engine == ENGINE_WATERSHED ? "watershed" : "erode";
+    if (format == FORMAT_CSV) {
+        print_csv(results, iterations, engine_name, element_spec, threads);
+    } else {
+        print_json(results, iterations, engine_name, element_spec, threads);
+    }
+
+    for (int t = 0; t < TIERS_AMOUNT; ++t) {
+        for (int stage = 0; stage < STAGES_AMOUNT; ++stage) {
+            free(results[t].samples[stage]);
+        }
+    }
+    // pipeline_free clears the pool pointer, so stop the pool first
+    if (pipeline.pool) {
+        tile_pool_finish(pipeline.pool);
+    }
+    pipeline_free(&pipeline);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#include "binary_image.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int binary_reserve(BinaryImage *image, int width, int height) {
+    int words = (width + 63) / 64 + 2;
+    size_t size = (size_t)(height + 2) * words;
+    if (size > image->capacity) {
+        free(image->data);
+        image->data = malloc(size * sizeof(uint64_t));
+        image->capacity = image->data ? size : 0;
+        if (!image->data) return 0;
+    }
+
+    image->width = width;
+    image->height = height;
+    image->words = words;
+    memset(image->data, 0, size * sizeof(uint64_t));
+    return 1;
+}
+
+void binary_free(BinaryImage *image) {
+    free(image->data);
+    image->data = NULL;
+    image->capacity = 0;
+}
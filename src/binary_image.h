@@ -0,0 +1,34 @@
+#ifndef BINARY_IMAGE_H
+#define BINARY_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bit-packed black/white image, one bit per pixel (set = white). Like Image it is stored
+// row by row: each row is a run of 64 bit words, pixel x living in bit x % 64 of word
+// x / 64. Every row has a zero word before and after it and there is a zero row above and
+// below, so neighbour reads and shifts across word edges need no bounds checks.
+// Pixels are addressed by a single index (word * 64 + bit) that grows in scan order,
+// where x +/- 1 is index +/- 1 and y +/- 1 is index +/- 64 * words.
+typedef struct {
+    int width;
+    int height;
+    int words; // words per row, padding included
+    size_t capacity;
+    uint64_t *data;
+} BinaryImage;
+
+#define BINARY_ROW(image, y) ((image)->data + (size_t)((y) + 1) * (image)->words + 1)
+#define BINARY_INDEX(image, x, y) ((((y) + 1) * (image)->words + 1) * 64 + (x))
+#define BINARY_PLANE_WORDS(image) ((size_t)((image)->height + 2) * (image)->words)
+#define BINARY_GET(data, index) (((data)[(index) >> 6] >> ((index) & 63)) & 1)
+#define BINARY_SET(data, index) ((data)[(index) >> 6] |= (uint64_t)1 << ((index) & 63))
+#define BINARY_CLEAR(data, index) ((data)[(index) >> 6] &= ~((uint64_t)1 << ((index) & 63)))
+
+// Sets the dimensions and clears every pixel, reusing the current buffer when it is large
+// enough. Returns 0 on allocation failure.
+int binary_reserve(BinaryImage *image, int width, int height);
+
+void binary_free(BinaryImage *image);
+
+#endif
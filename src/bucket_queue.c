@@ -0,0 +1,68 @@
+#include "bucket_queue.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+#define EMPTY -1
+
+int bucket_queue_reserve(BucketQueue *queue, size_t pixels, size_t max_level) {
+    // Pixels and levels are pushed as int
+    if (pixels > INT_MAX || max_level >= INT_MAX) return 0;
+    if (pixels > queue->next_capacity) {
+        free(queue->next);
+        queue->next = malloc(pixels * sizeof(int));
+        queue->next_capacity = queue->next ? pixels : 0;
+        if (!queue->next) return 0;
+    }
+    int levels = (int)max_level + 1;
+    if (levels > queue->levels_capacity) {
+        free(queue->head);
+        free(queue->tail);
+        queue->head = malloc(levels * sizeof(int));
+        queue->tail = malloc(levels * sizeof(int));
+        queue->levels_capacity = (queue->head && queue->tail) ? levels : 0;
+        if (!queue->levels_capacity) return 0;
+    }
+    for (int i = 0; i < levels; ++i) {
+        queue->head[i] = EMPTY;
+    }
+    queue->level = 0;
+    queue->size = 0;
+    return 1;
+}
+
+void bucket_queue_push(BucketQueue *queue, int pixel, int level) {
+    queue->next[pixel] = EMPTY;
+    if (queue->head[level] == EMPTY) {
+        queue->head[level] = pixel;
+    } else {
+        queue->next[queue->tail[level]] = pixel;
+    }
+    queue->tail[level] = pixel;
+    if (level > queue->level) {
+        queue->level = level;
+    }
+    queue->size++;
+}
+
+int bucket_queue_pop(BucketQueue *queue) {
+    // Levels above the current one are always empty, so the search only walks down
+    while (queue->head[queue->level] == EMPTY) {
+        queue->level--;
+    }
+    int pixel = queue->head[queue->level];
+    queue->head[queue->level] = queue->next[pixel];
+    queue->size--;
+    return pixel;
+}
+
+void bucket_queue_free(BucketQueue *queue) {
+    free(queue->next);
+    free(queue->head);
+    free(queue->tail);
+    queue->next = NULL;
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->next_capacity = 0;
+    queue->levels_capacity = 0;
+}
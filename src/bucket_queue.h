@@ -0,0 +1,32 @@
+#ifndef BUCKET_QUEUE_H
+#define BUCKET_QUEUE_H
+
+#include <stddef.h>
+
+// Hierarchical queue of pixel indices with small integer levels, for flooding. Every level
+// is a FIFO linked through a per-pixel next array, so push and pop are O(1) and a pixel
+// may only be in the queue once at a time. Pops come from the highest non-empty level.
+typedef struct {
+    int *next;
+    size_t next_capacity;
+    int *head;
+    int *tail;
+    int levels_capacity;
+    int level;
+    size_t size;
+} BucketQueue;
+
+// Prepares an empty queue for pixel indices below pixels and levels 0..max_level. Returns 0
+// when either does not fit an int, or on allocation failure.
+int bucket_queue_reserve(BucketQueue *queue, size_t pixels, size_t max_level);
+
+void bucket_queue_push(BucketQueue *queue, int pixel, int level);
+
+// Removes and returns the oldest pixel of the highest level. The queue must not be empty.
+int bucket_queue_pop(BucketQueue *queue);
+
+static inline int bucket_queue_is_empty(const BucketQueue *queue) { return queue->size == 0; }
+
+void bucket_queue_free(BucketQueue *queue);
+
+#endif
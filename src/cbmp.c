@@ -1,15 +1,26 @@
 #include "cbmp.h"
+#include "kernels.h"
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 // Constants
 
 #define BITS_PER_BYTE 8
 
-#define BLUE 0
-#define GREEN 1
-#define RED 2
 #define ALPHA 3
 
+#define FILE_SIZE_BYTES 4
+#define FILE_SIZE_OFFSET 2
+
 #define PIXEL_ARRAY_START_BYTES 4
 #define PIXEL_ARRAY_START_OFFSET 10
 
@@ -22,18 +33,26 @@
 #define DEPTH_BYTES 2
 #define DEPTH_OFFSET 28
 
-// Pixel structure
-typedef struct pixel_data {
-    unsigned char red;
-    unsigned char green;
-    unsigned char blue;
-    unsigned char alpha;
-} pixel;
+#define HEADER_MIN_BYTES 54
+#define MAX_HEADER_BYTES 65536
+
+// Painted pixels at most this many bytes apart are patched as one span
+#define PAINT_SPAN_GAP 64
+
+// Segments handed to one writev call
+#if defined(IOV_MAX)
+#define WRITE_VECTORS IOV_MAX
+#elif defined(UIO_MAXIOV)
+#define WRITE_VECTORS UIO_MAXIOV
+#else
+#define WRITE_VECTORS 16
+#endif
 
 // BMP structure
-typedef struct BMP_data {
+struct BMP_data {
     unsigned int file_byte_number;
     unsigned char *file_byte_contents;
+    int is_mapped;
 
     unsigned int pixel_array_start;
 
@@ -41,150 +60,596 @@ typedef struct BMP_data {
     unsigned int height;
     unsigned int depth;
 
-    pixel *pixels;
-} BMP;
-
-BMP *out_bmp = NULL;
+    // Row geometry, derived once from the header
+    unsigned int channels;
+    size_t row_size;
+    int top_down;
+};
+
+// Bitmap file accessed a block of rows at a time. header holds the bytes before the pixel
+// array only; block is reused for every block read or written, and holds the file rows of
+// image rows block_y0 to block_y0 + block_rows - 1 after a read.
+struct BMP_stream {
+    BMP *header;
+    FILE *fp;
+    unsigned char *block;
+    size_t block_capacity;
+    int block_y0;
+    int block_rows;
+};
+
+// A painted pixel: where it is and its colour
+typedef struct {
+    int x;
+    int y;
+    unsigned char colour[3];
+} PaintedPixel;
+
+// A piece of the output file, either bytes of the bitmap itself or of the patch buffer
+typedef struct {
+    const unsigned char *source;
+    size_t offset;
+    size_t length;
+} PaintSegment;
+
+// Pixels painted since the last encode in painting order, the same sorted by row with
+// row_start[y] the first of row y, and the output file encode_painted_bitmap made of them:
+// the unchanged stretches of the bitmap between the patched row spans copied into buffer.
+// The bitmap's bytes are never written to.
+struct BMP_paint {
+    PaintedPixel *pixels;
+    PaintedPixel *sorted;
+    int pixels_amount;
+    int pixels_capacity;
+    int *row_start;
+    int rows_capacity;
+
+    unsigned char *buffer;
+    size_t buffer_length;
+    size_t buffer_capacity;
+    PaintSegment *segments;
+    int segments_amount;
+    int segments_capacity;
+};
 
 // Private (ex-public) function declarations
 BMP *bopen(char *file_path);
-BMP *b_deep_copy(BMP *to_copy);
+BMP *b_template(BMP *source);
 int get_width(BMP *bmp);
 int get_height(BMP *bmp);
 unsigned int get_depth(BMP *bmp);
-void get_pixel_rgb(BMP *bmp, int x, int y, unsigned char *r, unsigned char *g, unsigned char *b);
-void set_pixel_rgb(BMP *bmp, int x, int y, unsigned char r, unsigned char g, unsigned char b);
 void bwrite(BMP *bmp, char *file_name);
-void bclose(BMP *bmp);
 
 // Private function declarations
 void _throw_error(char *message);
 unsigned int _get_int_from_buffer(unsigned int bytes, unsigned int offset, unsigned char *buffer);
 unsigned int _get_file_byte_number(FILE *fp);
 unsigned char *_get_file_byte_contents(FILE *fp, unsigned int file_byte_number);
+const char *_load_file_byte_contents(BMP *bmp, char *file_path);
 int _validate_file_type(unsigned char *file_byte_contents);
 int _validate_depth(unsigned int depth);
 unsigned int _get_pixel_array_start(unsigned char *file_byte_contents);
 int _get_width(unsigned char *file_byte_contents);
 int _get_height(unsigned char *file_byte_contents);
 unsigned int _get_depth(unsigned char *file_byte_contents);
-void _update_file_byte_contents(BMP *bmp, int index, int offset, int channel);
-void _populate_pixel_array(BMP *bmp);
-void _map(BMP *bmp, void (*f)(BMP *bmp, int, int, int));
-void _get_pixel(BMP *bmp, int index, int offset, int channel);
+unsigned char *_get_row(BMP *bmp, unsigned int y);
+void _match_template(BMP *in_bmp, BMP **output_template);
+BMP *_open_input(char *input_file_path, BMP **output_template);
+void _decode_row(BMP *bmp, const unsigned char *src, Image *output_image, int y);
+const char *_parse_header(BMP *bmp);
+int _seek(FILE *fp, long long offset);
+unsigned char *_read_stream_block(BMPStream *stream, int y0, int rows);
+unsigned char *_stream_row(BMPStream *stream, unsigned char *block, int y0, int rows, int y);
+size_t _painted_size(BMP *bmp);
+void *_grow(void *items, int *capacity, size_t item_size);
+unsigned char *_reserve_patch(BitmapPaint *paint, size_t length);
+void _add_segment(BitmapPaint *paint, const unsigned char *source, size_t offset, size_t length);
+size_t _patch_row(BMP *bmp, BitmapPaint *paint, unsigned int y, PaintedPixel *pixels, int amount);
+
+// Makes sure the output template matches the size and depth of the input
+void _match_template(BMP *in_bmp, BMP **output_template) {
+    int width = get_width(in_bmp);
+    int height = get_height(in_bmp);
+    // The output template follows the most recently read size
+    BMP *out_bmp = *output_template;
+    if (out_bmp != NULL && (get_width(out_bmp) != width || get_height(out_bmp) != height || get_depth(out_bmp) != get_depth(in_bmp))) {
+        bclose(out_bmp);
+        out_bmp = NULL;
+    }
+    if (out_bmp == NULL) {
+        out_bmp = b_template(in_bmp);
+    }
+    *output_template = out_bmp;
+}
+
+// Opens the input file and makes sure the output template matches it
+BMP *_open_input(char *input_file_path, BMP **output_template) {
+    BMP *in_bmp = bopen(input_file_path);
+    if (!in_bmp) exit(1);
+    _match_template(in_bmp, output_template);
+    return in_bmp;
+}
+
+// Copies one file row into row y of output_image. Both keep the file's channel order, so
+// 24-bit rows are copied as they are and 32-bit rows only drop the alpha channel.
+void _decode_row(BMP *bmp, const unsigned char *src, Image *output_image, int y) {
+    unsigned int channels = bmp->channels;
+    unsigned char *dst = IMAGE_ROW(output_image, y);
+    if (channels == BMP_CHANNELS) {
+        memcpy(dst, src, (size_t)output_image->width * BMP_CHANNELS);
+        return;
+    }
+    for (int x = 0; x < output_image->width; x++, src += channels, dst += BMP_CHANNELS) {
+        dst[BLUE] = src[BLUE];
+        dst[GREEN] = src[GREEN];
+        dst[RED] = src[RED];
+    }
+}
 
 // Public function implementations
-void read_bitmap(char *input_file_path, unsigned char output_image_array[BMP_WIDTH][BMP_HEIGHT][BMP_CHANNELS]) {
+void read_bitmap(char *input_file_path, Image *output_image, BMP **output_template) {
     // Read image into BMP struct
-    BMP *in_bmp = bopen(input_file_path);
+    BMP *in_bmp = _open_input(input_file_path, output_template);
     int width = get_width(in_bmp);
     int height = get_height(in_bmp);
-    if (width != BMP_WIDTH || height != BMP_HEIGHT) {
-        _throw_error("Invalid bitmap width and/or height. Must be 950x950 pixels.");
+    if (!image_reserve(output_image, width, height, BMP_CHANNELS)) {
+        _throw_error("Could not allocate memory for the image");
     }
-    if (out_bmp == NULL) {
-        out_bmp = b_deep_copy(in_bmp);
-    }
-    // Convert to RGB array
-    unsigned char r;
-    unsigned char g;
-    unsigned char b;
-    for (int x = 0; x < BMP_WIDTH; x++) {
-        for (int y = 0; y < BMP_HEIGHT; y++) {
-            get_pixel_rgb(in_bmp, x, y, &r, &g, &b);
-            output_image_array[x][BMP_HEIGHT - 1 - y][0] = r;
-            output_image_array[x][BMP_HEIGHT - 1 - y][1] = g;
-            output_image_array[x][BMP_HEIGHT - 1 - y][2] = b;
-        }
+    // Copy the pixels over, one file row at a time
+    for (int y = 0; y < height; y++) {
+        _decode_row(in_bmp, _get_row(in_bmp, y), output_image, y);
     }
     bclose(in_bmp);
 }
 
-void write_bitmap(unsigned char input_image_array[BMP_WIDTH][BMP_HEIGHT][BMP_CHANNELS], char *output_file_path) {
-    if (out_bmp == NULL) {
-        _throw_error("The function 'read_bitmap' must be called at least once before calling the function 'write_bitmap'.");
+BMP *open_bitmap(char *input_file_path) { return bopen(input_file_path); }
+
+void decode_bitmap_greyscale(BMP *in_bmp, Image *greyscale_image, Histogram *histogram, BMP **output_template) {
+    if (output_template) {
+        _match_template(in_bmp, output_template);
     }
-    unsigned char r;
-    unsigned char g;
-    unsigned char b;
-    for (int x = 0; x < BMP_WIDTH; x++) {
-        for (int y = 0; y < BMP_HEIGHT; y++) {
-            r = input_image_array[x][BMP_HEIGHT - 1 - y][0];
-            g = input_image_array[x][BMP_HEIGHT - 1 - y][1];
-            b = input_image_array[x][BMP_HEIGHT - 1 - y][2];
-            set_pixel_rgb(out_bmp, x, y, r, g, b);
+    int width = get_width(in_bmp);
+    int height = get_height(in_bmp);
+    if (!image_reserve(greyscale_image, width, height, 1)) {
+        _throw_error("Could not allocate memory for the image");
+    }
+
+    // Every file row is read once: converted to its greyscale row, which is then counted
+    // while it is still in L1
+    const Kernels *k = kernels();
+    unsigned int channels = in_bmp->channels;
+    for (int y = 0; y < height; y++) {
+        const unsigned char *src = _get_row(in_bmp, y);
+        unsigned char *row = IMAGE_ROW(greyscale_image, y);
+        if (channels == BMP_CHANNELS) {
+            // The channel sum does not depend on their order, so BGR goes in as is
+            k->greyscale(src, row, width);
+        } else {
+            for (int x = 0; x < width; x++) {
+                row[x] = ((unsigned int)src[x * channels] + src[x * channels + 1] + src[x * channels + 2]) >> 2;
+            }
         }
+        histogram_add(histogram, row, width);
     }
-    bwrite(out_bmp, output_file_path);
 }
 
-// Private (ex-public) function declarations
-BMP *bopen(char *file_path) {
-    FILE *fp = fopen(file_path, "rb");
+BitmapPaint *create_bitmap_paint(void) {
+    BitmapPaint *paint = calloc(1, sizeof(BitmapPaint));
+    if (!paint) {
+        _throw_error("Could not allocate memory for the painted pixels");
+    }
+    return paint;
+}
+
+void paint_pixel(BitmapPaint *paint, int x, int y, unsigned char red, unsigned char green, unsigned char blue) {
+    if (paint->pixels_amount == paint->pixels_capacity) {
+        int capacity = paint->pixels_capacity;
+        paint->pixels = _grow(paint->pixels, &capacity, sizeof(PaintedPixel));
+        paint->sorted = _grow(paint->sorted, &paint->pixels_capacity, sizeof(PaintedPixel));
+    }
+    PaintedPixel *pixel = &paint->pixels[paint->pixels_amount++];
+    pixel->x = x;
+    pixel->y = y;
+    pixel->colour[RED] = red;
+    pixel->colour[GREEN] = green;
+    pixel->colour[BLUE] = blue;
+}
 
+void encode_painted_bitmap(BMP *bmp, BitmapPaint *paint) {
+    paint->buffer_length = 0;
+    paint->segments_amount = 0;
+
+    // The header goes out with the size of the file write_bitmap writes, which leaves out
+    // anything after the pixel array
+    size_t size = _painted_size(bmp);
+    unsigned char *header = _reserve_patch(paint, bmp->pixel_array_start);
+    memcpy(header, bmp->file_byte_contents, bmp->pixel_array_start);
+    for (unsigned int i = 0; i < FILE_SIZE_BYTES; i++) {
+        header[FILE_SIZE_OFFSET + i] = (size >> (i * BITS_PER_BYTE)) & 0xFF;
+    }
+    _add_segment(paint, NULL, 0, bmp->pixel_array_start);
+
+    // Counting sort of the pixels inside the bitmap by row, keeping the painting order within
+    // each row
+    if (paint->rows_capacity < (int)bmp->height + 1) {
+        free(paint->row_start);
+        paint->rows_capacity = bmp->height + 1;
+        paint->row_start = malloc(paint->rows_capacity * sizeof(int));
+        if (!paint->row_start) {
+            _throw_error("Could not allocate memory for the painted pixels");
+        }
+    }
+    int *row_start = paint->row_start;
+    memset(row_start, 0, (bmp->height + 1) * sizeof(int));
+    int inside = 0;
+    for (int i = 0; i < paint->pixels_amount; i++) {
+        const PaintedPixel *pixel = &paint->pixels[i];
+        if (pixel->x >= 0 && pixel->y >= 0 && pixel->x < (int)bmp->width && pixel->y < (int)bmp->height) {
+            paint->pixels[inside++] = *pixel;
+            row_start[pixel->y + 1]++;
+        }
+    }
+    for (unsigned int y = 0; y < bmp->height; y++) {
+        row_start[y + 1] += row_start[y];
+    }
+    for (int i = 0; i < inside; i++) {
+        paint->sorted[row_start[paint->pixels[i].y]++] = paint->pixels[i];
+    }
+    // Each row_start[y] now holds the start of row y + 1
+    memmove(row_start + 1, row_start, bmp->height * sizeof(int));
+    row_start[0] = 0;
+
+    // Rows with painted pixels in file order, everything around them goes out as it is,
+    // row padding and alpha included
+    size_t unchanged = bmp->pixel_array_start;
+    for (unsigned int file_row = 0; file_row < bmp->height; file_row++) {
+        unsigned int y = bmp->top_down ? file_row : bmp->height - 1 - file_row;
+        int amount = row_start[y + 1] - row_start[y];
+        if (amount == 0) {
+            continue;
+        }
+        size_t row_offset = (size_t)(_get_row(bmp, y) - bmp->file_byte_contents);
+        _add_segment(paint, bmp->file_byte_contents, unchanged, row_offset - unchanged);
+        unchanged = row_offset + _patch_row(bmp, paint, y, paint->sorted + row_start[y], amount);
+    }
+    _add_segment(paint, bmp->file_byte_contents, unchanged, size - unchanged);
+    paint->pixels_amount = 0;
+}
+
+void write_painted_bitmap(BMP *bmp, BitmapPaint *paint, char *output_file_path) {
+    encode_painted_bitmap(bmp, paint);
+#ifndef _WIN32
+    // The segments go out with as few writev calls as WRITE_VECTORS allows, continuing any
+    // write the kernel cuts short
+    int fd = open(output_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error opening output file");
+        return;
+    }
+    struct iovec vectors[WRITE_VECTORS];
+    int next = 0;
+    size_t skip = 0;
+    while (next < paint->segments_amount) {
+        int count = 0;
+        for (int i = next; i < paint->segments_amount && count < WRITE_VECTORS; i++, count++) {
+            const PaintSegment *segment = &paint->segments[i];
+            const unsigned char *data = (segment->source ? segment->source : paint->buffer) + segment->offset;
+            size_t offset = i == next ? skip : 0;
+            vectors[count].iov_base = (void *)(data + offset);
+            vectors[count].iov_len = segment->length - offset;
+        }
+        ssize_t written = writev(fd, vectors, count);
+        if (written <= 0) {
+            perror("Error writing output file");
+            break;
+        }
+        // Step over the segments written, remembering how far into the last one it got
+        for (size_t left = written; left > 0;) {
+            size_t rest = paint->segments[next].length - skip;
+            if (left < rest) {
+                skip += left;
+                break;
+            }
+            left -= rest;
+            skip = 0;
+            next++;
+        }
+    }
+    close(fd);
+#else
+    FILE *fp = fopen(output_file_path, "wb");
     if (fp == NULL) {
+        perror("Error opening output file");
+        return;
+    }
+    for (int i = 0; i < paint->segments_amount; i++) {
+        const PaintSegment *segment = &paint->segments[i];
+        fwrite((segment->source ? segment->source : paint->buffer) + segment->offset, 1, segment->length, fp);
+    }
+    fclose(fp);
+#endif
+}
+
+void free_bitmap_paint(BitmapPaint *paint) {
+    free(paint->pixels);
+    free(paint->sorted);
+    free(paint->row_start);
+    free(paint->buffer);
+    free(paint->segments);
+    free(paint);
+}
+
+void write_bitmap(Image *input_image, BMP *out_bmp, char *output_file_path) {
+    encode_bitmap(input_image, out_bmp);
+    bwrite(out_bmp, output_file_path);
+}
+
+void encode_bitmap(Image *input_image, BMP *out_bmp) {
+    if (out_bmp == NULL) {
+        _throw_error("The function 'read_bitmap' must be called at least once before calling the function 'write_bitmap'.");
+    }
+    if (get_width(out_bmp) != input_image->width || get_height(out_bmp) != input_image->height) {
+        _throw_error("The image passed to 'write_bitmap' must match the size of the last image read.");
+    }
+    // Encode straight into the file buffer, alpha and row padding keep the template values
+    unsigned int channels = out_bmp->channels;
+    const int width = input_image->width;
+    const int height = input_image->height;
+    for (int y = 0; y < height; y++) {
+        unsigned char *dst = _get_row(out_bmp, y);
+        const unsigned char *src = IMAGE_ROW(input_image, y);
+        if (channels == BMP_CHANNELS) {
+            memcpy(dst, src, (size_t)width * BMP_CHANNELS);
+            continue;
+        }
+        for (int x = 0; x < width; x++, dst += channels, src += BMP_CHANNELS) {
+            dst[BLUE] = src[BLUE];
+            dst[GREEN] = src[GREEN];
+            dst[RED] = src[RED];
+        }
+    }
+}
+
+BMPStream *open_bitmap_stream(char *input_file_path) {
+    BMPStream *stream = calloc(1, sizeof(BMPStream));
+    BMP *header = calloc(1, sizeof(BMP));
+    unsigned char start[HEADER_MIN_BYTES];
+    if (!stream || !header) {
+        _throw_error("Could not allocate memory for the bitmap stream");
+    }
+    stream->header = header;
+    stream->fp = fopen(input_file_path, "rb");
+    if (stream->fp == NULL) {
         perror("Error opening file");
         exit(EXIT_FAILURE);
     }
 
-    BMP *bmp = (BMP *)malloc(sizeof(BMP));
-    bmp->file_byte_number = _get_file_byte_number(fp);
-    bmp->file_byte_contents = _get_file_byte_contents(fp, bmp->file_byte_number);
-    fclose(fp);
+    // Only the header is kept, the pixel array is read block by block
+    if (fread(start, 1, HEADER_MIN_BYTES, stream->fp) != HEADER_MIN_BYTES || !_validate_file_type(start)) {
+        _throw_error("Invalid file type");
+    }
+    header->file_byte_number = _get_pixel_array_start(start);
+    if (header->file_byte_number < HEADER_MIN_BYTES || header->file_byte_number > MAX_HEADER_BYTES) {
+        _throw_error("Invalid file type");
+    }
+    header->file_byte_contents = malloc(header->file_byte_number);
+    if (!header->file_byte_contents) {
+        _throw_error("Could not allocate memory for the bitmap header");
+    }
+    memcpy(header->file_byte_contents, start, HEADER_MIN_BYTES);
+    if (fread(header->file_byte_contents + HEADER_MIN_BYTES, 1, header->file_byte_number - HEADER_MIN_BYTES, stream->fp) !=
+        header->file_byte_number - HEADER_MIN_BYTES) {
+        _throw_error("There was a problem reading the file");
+    }
+    const char *error = _parse_header(header);
+    if (error) {
+        _throw_error((char *)error);
+    }
+    return stream;
+}
 
+BMPStream *create_bitmap_stream(BMPStream *source, char *output_file_path) {
+    BMPStream *stream = calloc(1, sizeof(BMPStream));
+    BMP *header = malloc(sizeof(BMP));
+    if (!stream || !header) {
+        _throw_error("Could not allocate memory for the bitmap stream");
+    }
+    *header = *source->header;
+    header->file_byte_contents = malloc(header->file_byte_number);
+    if (!header->file_byte_contents) {
+        _throw_error("Could not allocate memory for the bitmap header");
+    }
+    memcpy(header->file_byte_contents, source->header->file_byte_contents, header->file_byte_number);
+    stream->header = header;
+
+    // The file size field only has 32 bits; 0 leaves it to the reader for larger files
+    unsigned long long size = header->pixel_array_start + (unsigned long long)header->row_size * header->height;
+    unsigned int i;
+    for (i = 0; i < FILE_SIZE_BYTES; i++) {
+        header->file_byte_contents[FILE_SIZE_OFFSET + i] = size <= 0xFFFFFFFFULL ? (size >> (i * BITS_PER_BYTE)) & 0xFF : 0;
+    }
+
+    stream->fp = fopen(output_file_path, "wb");
+    if (stream->fp == NULL || fwrite(header->file_byte_contents, 1, header->file_byte_number, stream->fp) != header->file_byte_number) {
+        perror("Error opening output file");
+        exit(EXIT_FAILURE);
+    }
+    return stream;
+}
+
+int bitmap_stream_width(BMPStream *stream) { return stream->header->width; }
+
+int bitmap_stream_height(BMPStream *stream) { return stream->header->height; }
+
+void read_stream_greyscale(BMPStream *stream, int y0, Image *greyscale_image, Histogram *histogram) {
+    const int rows = greyscale_image->height;
+    const int width = greyscale_image->width;
+    const unsigned int channels = stream->header->channels;
+    unsigned char *block = _read_stream_block(stream, y0, rows);
+    const Kernels *k = kernels();
+    for (int y = 0; y < rows; y++) {
+        const unsigned char *src = _stream_row(stream, block, y0, rows, y0 + y);
+        unsigned char *row = IMAGE_ROW(greyscale_image, y);
+        if (channels == BMP_CHANNELS) {
+            k->greyscale(src, row, width);
+        } else {
+            for (int x = 0; x < width; x++) {
+                row[x] = ((unsigned int)src[x * channels] + src[x * channels + 1] + src[x * channels + 2]) >> 2;
+            }
+        }
+        if (histogram) {
+            histogram_add(histogram, row, width);
+        }
+    }
+}
+
+void read_stream_rows(BMPStream *stream, int y0, Image *output_image) {
+    const int rows = output_image->height;
+    unsigned char *block = _read_stream_block(stream, y0, rows);
+    for (int y = 0; y < rows; y++) {
+        _decode_row(stream->header, _stream_row(stream, block, y0, rows, y0 + y), output_image, y);
+    }
+}
+
+void write_stream_rows(BMPStream *stream, BMPStream *source, int y0, Image *input_image) {
+    BMP *header = stream->header;
+    const int rows = input_image->height;
+    const int width = input_image->width;
+    const unsigned int channels = header->channels;
+    const size_t size = (size_t)rows * header->row_size;
+    if (source->block_y0 != y0 || source->block_rows != rows) {
+        _throw_error("The rows passed to 'write_stream_rows' must be the last ones read from its source.");
+    }
+    if (size > stream->block_capacity) {
+        free(stream->block);
+        stream->block = malloc(size);
+        stream->block_capacity = stream->block ? size : 0;
+        if (!stream->block) _throw_error("Could not allocate memory for the bitmap stream");
+    }
+    // Row padding and alpha are the source's, like the pixels write_painted_bitmap leaves alone
+    memcpy(stream->block, source->block, size);
+    for (int y = 0; y < rows; y++) {
+        unsigned char *dst = _stream_row(stream, stream->block, y0, rows, y0 + y);
+        const unsigned char *src = IMAGE_ROW(input_image, y);
+        if (channels == BMP_CHANNELS) {
+            memcpy(dst, src, (size_t)width * BMP_CHANNELS);
+            continue;
+        }
+        for (int x = 0; x < width; x++, dst += channels, src += BMP_CHANNELS) {
+            dst[BLUE] = src[BLUE];
+            dst[GREEN] = src[GREEN];
+            dst[RED] = src[RED];
+        }
+    }
+
+    int first_row = header->top_down ? y0 : (int)header->height - y0 - rows;
+    long long offset = header->pixel_array_start + (long long)first_row * header->row_size;
+    if (_seek(stream->fp, offset) != 0 || fwrite(stream->block, 1, size, stream->fp) != size) {
+        _throw_error("There was a problem writing the file");
+    }
+}
+
+void close_bitmap_stream(BMPStream *stream) {
+    fclose(stream->fp);
+    free(stream->header->file_byte_contents);
+    free(stream->header);
+    free(stream->block);
+    free(stream);
+}
+
+// Private (ex-public) function declarations
+// Reports a file that can not be read, naming it, and returns NULL instead of exiting, so that
+// a batch can go on with its other images
+BMP *bopen(char *file_path) {
+    BMP *bmp = (BMP *)calloc(1, sizeof(BMP));
+    if (!bmp) {
+        _throw_error("Could not allocate memory for the image");
+    }
+    const char *error = _load_file_byte_contents(bmp, file_path);
+    if (!error) {
+        error = _parse_header(bmp);
+    }
+    // Every row must lie inside the file; row_size is below INT_MAX, so the product can not wrap
+    if (!error &&
+        (bmp->pixel_array_start > bmp->file_byte_number || bmp->row_size * bmp->height > bmp->file_byte_number - bmp->pixel_array_start)) {
+        error = "Invalid file size";
+    }
+
+    if (error) {
+        fprintf(stderr, "[ERROR] Could not read %s: %s\n", file_path, error);
+        if (bmp->file_byte_contents) {
+            bclose(bmp);
+        } else {
+            free(bmp);
+        }
+        return NULL;
+    }
+    return bmp;
+}
+
+// Reads the geometry from the header at the start of file_byte_contents. Returns what is wrong
+// with it, or NULL when it is valid.
+const char *_parse_header(BMP *bmp) {
     if (!_validate_file_type(bmp->file_byte_contents)) {
-        _throw_error("Invalid file type");
+        return "Invalid file type";
     }
 
     bmp->pixel_array_start = _get_pixel_array_start(bmp->file_byte_contents);
 
+    // A negative height marks a top-down bitmap
+    int height = _get_height(bmp->file_byte_contents);
+    bmp->top_down = height < 0;
     bmp->width = _get_width(bmp->file_byte_contents);
-    bmp->height = _get_height(bmp->file_byte_contents);
+    bmp->height = bmp->top_down ? -height : height;
     bmp->depth = _get_depth(bmp->file_byte_contents);
 
-    // printf("bmp->width %d\n", bmp->width);
-    // printf("bmp->height %d\n", bmp->height);
-    // printf("bmp->depth %d\n", bmp->depth);
-
     if (!_validate_depth(bmp->depth)) {
-        _throw_error("Invalid file depth");
+        return "Invalid file depth";
     }
 
-    _populate_pixel_array(bmp);
-
-    return bmp;
+    // Rows are indexed with int further on, so the widest row must still fit one
+    if ((int)bmp->width <= 0 || (int)bmp->height <= 0 || bmp->width > (INT_MAX - 31) / bmp->depth) {
+        return "Invalid bitmap width and/or height.";
+    }
+    bmp->channels = bmp->depth / BITS_PER_BYTE;
+    bmp->row_size = (((size_t)bmp->depth * bmp->width + 31) / 32) * 4;
+    return NULL;
 }
 
-BMP *b_deep_copy(BMP *to_copy) {
-    BMP *copy = (BMP *)malloc(sizeof(BMP));
-    copy->file_byte_number = to_copy->file_byte_number;
-    copy->pixel_array_start = to_copy->pixel_array_start;
-    copy->width = to_copy->width;
-    copy->height = to_copy->height;
-    copy->depth = to_copy->depth;
+// Builds the output bitmap from the source header alone, the pixel rows are filled in by write_bitmap
+BMP *b_template(BMP *source) {
+    BMP *template = (BMP *)malloc(sizeof(BMP));
+    if (!template) {
+        _throw_error("Could not allocate memory for the output template");
+    }
+    *template = *source;
 
-    copy->file_byte_contents = (unsigned char *)malloc(copy->file_byte_number * sizeof(unsigned char));
+    unsigned int header_size = source->pixel_array_start;
+    template->file_byte_number = header_size + source->row_size * source->height;
+    template->file_byte_contents = (unsigned char *)calloc(template->file_byte_number, sizeof(unsigned char));
+    if (!template->file_byte_contents) {
+        _throw_error("Could not allocate memory for the output template");
+    }
+    template->is_mapped = 0;
+    memcpy(template->file_byte_contents, source->file_byte_contents, header_size);
 
+    // The source may carry trailing bytes, so the file size field is rewritten
     unsigned int i;
-    for (i = 0; i < copy->file_byte_number; i++) {
-        copy->file_byte_contents[i] = to_copy->file_byte_contents[i];
+    for (i = 0; i < FILE_SIZE_BYTES; i++) {
+        template->file_byte_contents[FILE_SIZE_OFFSET + i] = (template->file_byte_number >> (i * BITS_PER_BYTE)) & 0xFF;
     }
-
-    copy->pixels = (pixel *)malloc(copy->width * copy->height * sizeof(pixel));
-
-    unsigned int x, y;
-    int index;
-    for (y = 0; y < copy->height; y++) {
-        for (x = 0; x < copy->width; x++) {
-            index = y * copy->width + x;
-            copy->pixels[index].red = to_copy->pixels[index].red;
-            copy->pixels[index].green = to_copy->pixels[index].green;
-            copy->pixels[index].blue = to_copy->pixels[index].blue;
-            copy->pixels[index].alpha = to_copy->pixels[index].alpha;
+    // Rows are encoded without a source to copy alpha from, so 32-bit output is opaque
+    if (template->channels == 4) {
+        unsigned int x, y;
+        for (y = 0; y < template->height; y++) {
+            unsigned char *row = _get_row(template, y);
+            for (x = 0; x < template->width; x++) {
+                row[x * 4 + ALPHA] = 0xFF;
+            }
         }
     }
 
-    return copy;
+    return template;
 }
 
 int get_width(BMP *bmp) { return bmp->width; }
@@ -193,32 +658,26 @@ int get_height(BMP *bmp) { return bmp->height; }
 
 unsigned int get_depth(BMP *bmp) { return bmp->depth; }
 
-void get_pixel_rgb(BMP *bmp, int x, int y, unsigned char *r, unsigned char *g, unsigned char *b) {
-    int index = y * bmp->width + x;
-    *r = bmp->pixels[index].red;
-    *g = bmp->pixels[index].green;
-    *b = bmp->pixels[index].blue;
-}
-
-void set_pixel_rgb(BMP *bmp, int x, int y, unsigned char r, unsigned char g, unsigned char b) {
-    int index = y * bmp->width + x;
-    bmp->pixels[index].red = r;
-    bmp->pixels[index].green = g;
-    bmp->pixels[index].blue = b;
-}
-
 void bwrite(BMP *bmp, char *file_name) {
-    _map(bmp, _update_file_byte_contents);
-
     FILE *fp = fopen(file_name, "wb");
+    if (fp == NULL) {
+        perror("Error opening output file");
+        return;
+    }
     fwrite(bmp->file_byte_contents, sizeof(char), bmp->file_byte_number, fp);
     fclose(fp);
 }
 
 void bclose(BMP *bmp) {
-    free(bmp->pixels);
-    bmp->pixels = NULL;
+#ifndef _WIN32
+    if (bmp->is_mapped) {
+        munmap(bmp->file_byte_contents, bmp->file_byte_number);
+    } else {
+        free(bmp->file_byte_contents);
+    }
+#else
     free(bmp->file_byte_contents);
+#endif
     bmp->file_byte_contents = NULL;
     free(bmp);
     bmp = NULL;
@@ -232,15 +691,12 @@ void _throw_error(char *message) {
 }
 
 unsigned int _get_int_from_buffer(unsigned int bytes, unsigned int offset, unsigned char *buffer) {
-    unsigned char *_buffer = (unsigned char *)malloc(bytes * sizeof(unsigned char));
-
+    // Little-endian, assembled byte by byte so unaligned offsets are fine
+    unsigned int value = 0;
     unsigned int i;
     for (i = 0; i < bytes; i++) {
-        _buffer[i] = buffer[i + offset];
+        value |= (unsigned int)buffer[offset + i] << (i * BITS_PER_BYTE);
     }
-
-    unsigned int value = *(unsigned int *)_buffer;
-    free(_buffer);
     return value;
 }
 
@@ -254,13 +710,63 @@ unsigned int _get_file_byte_number(FILE *fp) {
 
 unsigned char *_get_file_byte_contents(FILE *fp, unsigned int file_byte_number) {
     unsigned char *buffer = (unsigned char *)malloc(file_byte_number * sizeof(char));
-    unsigned int result = fread(buffer, 1, file_byte_number, fp);
+    if (buffer && fread(buffer, 1, file_byte_number, fp) != file_byte_number) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
 
-    if (result != file_byte_number) {
-        _throw_error("There was a problem reading the file");
+// Maps the file read-only where mmap is available, otherwise reads it into a heap buffer.
+// Returns what went wrong, or NULL once file_byte_contents holds the file.
+const char *_load_file_byte_contents(BMP *bmp, char *file_path) {
+#ifndef _WIN32
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        return strerror(errno);
     }
 
-    return buffer;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        const char *error = strerror(errno);
+        close(fd);
+        return error;
+    }
+    // Larger files do not fit file_byte_number; --stream reads them a block at a time
+    if (file_stat.st_size < HEADER_MIN_BYTES || file_stat.st_size > UINT_MAX) {
+        close(fd);
+        return file_stat.st_size < HEADER_MIN_BYTES ? "Invalid file type" : "File too large, use --stream";
+    }
+
+    bmp->file_byte_number = file_stat.st_size;
+    unsigned char *contents = mmap(NULL, bmp->file_byte_number, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (contents == MAP_FAILED) {
+        return "There was a problem mapping the file";
+    }
+    madvise(contents, bmp->file_byte_number, MADV_SEQUENTIAL);
+    bmp->file_byte_contents = contents;
+    bmp->is_mapped = 1;
+#else
+    FILE *fp = fopen(file_path, "rb");
+
+    if (fp == NULL) {
+        return strerror(errno);
+    }
+
+    bmp->file_byte_number = _get_file_byte_number(fp);
+    if (bmp->file_byte_number < HEADER_MIN_BYTES) {
+        fclose(fp);
+        return "Invalid file type";
+    }
+    bmp->file_byte_contents = _get_file_byte_contents(fp, bmp->file_byte_number);
+    bmp->is_mapped = 0;
+    fclose(fp);
+    if (!bmp->file_byte_contents) {
+        return "There was a problem reading the file";
+    }
+#endif
+    return NULL;
 }
 
 int _validate_file_type(unsigned char *file_byte_contents) { return file_byte_contents[0] == 'B' && file_byte_contents[1] == 'M'; }
@@ -275,73 +781,137 @@ int _get_width(unsigned char *file_byte_contents) { return (int)_get_int_from_bu
 
 int _get_height(unsigned char *file_byte_contents) { return (int)_get_int_from_buffer(HEIGHT_BYTES, HEIGHT_OFFSET, file_byte_contents); }
 
-unsigned int _get_depth(unsigned char *file_byte_contents) {
-    if (_get_int_from_buffer(DEPTH_BYTES, DEPTH_OFFSET, file_byte_contents) == 32 ||
-        _get_int_from_buffer(DEPTH_BYTES, DEPTH_OFFSET, file_byte_contents) == 24) {
-        return _get_int_from_buffer(DEPTH_BYTES, DEPTH_OFFSET, file_byte_contents);
-    } else {
-        // We are in a windows environment (patch)
-        // printf("%d", (_get_int_from_buffer(DEPTH_BYTES, DEPTH_OFFSET, file_byte_contents)) & 0xFF );
-        return (_get_int_from_buffer(DEPTH_BYTES, DEPTH_OFFSET, file_byte_contents)) & 0xFF;
-    }
-}
-
-void _update_file_byte_contents(BMP *bmp, int index, int offset, int channel) {
-    char value;
-    switch (channel) {
-    case BLUE:
-        value = bmp->pixels[index].blue;
-        break;
-    case GREEN:
-        value = bmp->pixels[index].green;
-        break;
-    case RED:
-        value = bmp->pixels[index].red;
-        break;
-    case ALPHA:
-        value = bmp->pixels[index].alpha;
-        break;
-    }
-    bmp->file_byte_contents[offset + channel] = value;
-}
-
-void _populate_pixel_array(BMP *bmp) {
-    bmp->pixels = (pixel *)malloc(bmp->width * bmp->height * sizeof(pixel));
-    _map(bmp, _get_pixel);
-}
-
-void _map(BMP *bmp, void (*f)(BMP *, int, int, int)) {
-    int channels = bmp->depth / (sizeof(unsigned char) * BITS_PER_BYTE);
-    int row_size = ((int)(bmp->depth * bmp->width + 31) / 32) * 4;
-    int padding = row_size - bmp->width * channels;
-
-    int c;
-    unsigned int x, y, index, offset;
-    for (y = 0; y < bmp->height; y++) {
-        for (x = 0; x < bmp->width; x++) {
-            index = y * bmp->width + x;
-            offset = bmp->pixel_array_start + index * channels + y * padding;
-            for (c = 0; c < channels; c++) {
-                (*f)(bmp, index, offset, c);
-            }
+unsigned int _get_depth(unsigned char *file_byte_contents) { return _get_int_from_buffer(DEPTH_BYTES, DEPTH_OFFSET, file_byte_contents); }
+
+int _seek(FILE *fp, long long offset) {
+#ifdef _WIN32
+    return _fseeki64(fp, offset, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+// Reads the file rows of image rows y0..y0+rows-1 in one go; they are next to each other in
+// the file, in reverse order for a bottom-up bitmap
+unsigned char *_read_stream_block(BMPStream *stream, int y0, int rows) {
+    BMP *header = stream->header;
+    const size_t size = (size_t)rows * header->row_size;
+    if (size > stream->block_capacity) {
+        free(stream->block);
+        stream->block = malloc(size);
+        stream->block_capacity = stream->block ? size : 0;
+        if (!stream->block) _throw_error("Could not allocate memory for the bitmap stream");
+    }
+    int first_row = header->top_down ? y0 : (int)header->height - y0 - rows;
+    if (_seek(stream->fp, header->pixel_array_start + (long long)first_row * header->row_size) != 0 ||
+        fread(stream->block, 1, size, stream->fp) != size) {
+        _throw_error("Invalid file size");
+    }
+    stream->block_y0 = y0;
+    stream->block_rows = rows;
+    return stream->block;
+}
+
+// Image row y within a block holding image rows y0..y0+rows-1
+unsigned char *_stream_row(BMPStream *stream, unsigned char *block, int y0, int rows, int y) {
+    int index = stream->header->top_down ? y - y0 : y0 + rows - 1 - y;
+    return block + (size_t)index * stream->header->row_size;
+}
+
+// Bytes write_bitmap would write for this bitmap: the header and the pixel array
+size_t _painted_size(BMP *bmp) { return bmp->pixel_array_start + bmp->row_size * bmp->height; }
+
+void *_grow(void *items, int *capacity, size_t item_size) {
+    int grown_capacity = *capacity ? *capacity * 2 : 256;
+    void *grown = realloc(items, grown_capacity * item_size);
+    if (!grown) {
+        _throw_error("Could not allocate memory for the painted pixels");
+    }
+    *capacity = grown_capacity;
+    return grown;
+}
+
+// Room for length more bytes at the end of the patch buffer
+unsigned char *_reserve_patch(BitmapPaint *paint, size_t length) {
+    if (paint->buffer_length + length > paint->buffer_capacity) {
+        size_t capacity = paint->buffer_capacity ? paint->buffer_capacity : 4096;
+        while (capacity < paint->buffer_length + length) {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(paint->buffer, capacity);
+        if (!grown) {
+            _throw_error("Could not allocate memory for the painted pixels");
         }
+        paint->buffer = grown;
+        paint->buffer_capacity = capacity;
     }
+    return paint->buffer + paint->buffer_length;
 }
 
-void _get_pixel(BMP *bmp, int index, int offset, int channel) {
-    unsigned char value = _get_int_from_buffer(sizeof(unsigned char), offset + channel, bmp->file_byte_contents);
-    switch (channel) {
-    case BLUE:
-        bmp->pixels[index].blue = value;
-        break;
-    case GREEN:
-        bmp->pixels[index].green = value;
-        break;
-    case RED:
-        bmp->pixels[index].red = value;
-        break;
-    case ALPHA:
-        bmp->pixels[index].alpha = value;
-        break;
+// Appends length bytes of source from offset to the output, of the patch buffer when source
+// is NULL, where they were reserved last
+void _add_segment(BitmapPaint *paint, const unsigned char *source, size_t offset, size_t length) {
+    if (length == 0) {
+        return;
     }
+    if (source == NULL) {
+        offset = paint->buffer_length;
+        paint->buffer_length += length;
+    }
+    if (paint->segments_amount == paint->segments_capacity) {
+        paint->segments = _grow(paint->segments, &paint->segments_capacity, sizeof(PaintSegment));
+    }
+    PaintSegment *segment = &paint->segments[paint->segments_amount++];
+    segment->source = source;
+    segment->offset = offset;
+    segment->length = length;
+}
+
+// Adds the segments of row y up to its last painted pixel: the spans around the painted pixels
+// are copied into the patch buffer and painted there, with the bytes in between taken from the
+// bitmap. Pixels close together share a span. Returns how many bytes of the row are covered.
+size_t _patch_row(BMP *bmp, BitmapPaint *paint, unsigned int y, PaintedPixel *pixels, int amount) {
+    const unsigned int channels = bmp->channels;
+    const unsigned char *row = _get_row(bmp, y);
+    const size_t row_offset = (size_t)(row - bmp->file_byte_contents);
+
+    // A row holds a few pixels, an insertion sort by column keeps the painting order of pixels
+    // painted twice so the last paint wins
+    for (int i = 1; i < amount; i++) {
+        PaintedPixel pixel = pixels[i];
+        int j = i;
+        for (; j > 0 && pixels[j - 1].x > pixel.x; j--) {
+            pixels[j] = pixels[j - 1];
+        }
+        pixels[j] = pixel;
+    }
+
+    size_t covered = 0;
+    int next = 0;
+    while (next < amount) {
+        // One span: the next pixel and those within PAINT_SPAN_GAP bytes after it
+        size_t start = (size_t)pixels[next].x * channels;
+        size_t end = start + channels;
+        int last = next;
+        while (last + 1 < amount && (size_t)pixels[last + 1].x * channels <= end + PAINT_SPAN_GAP) {
+            last++;
+            end = (size_t)pixels[last].x * channels + channels;
+        }
+        _add_segment(paint, bmp->file_byte_contents, row_offset + covered, start - covered);
+        unsigned char *span = _reserve_patch(paint, end - start);
+        memcpy(span, row + start, end - start);
+        for (int p = next; p <= last; p++) {
+            memcpy(span + (size_t)pixels[p].x * channels - start, pixels[p].colour, 3);
+        }
+        _add_segment(paint, NULL, 0, end - start);
+        covered = end;
+        next = last + 1;
+    }
+    return covered;
+}
+
+// Returns the first byte of image row y (0 = top), whichever way the rows are stored
+unsigned char *_get_row(BMP *bmp, unsigned int y) {
+    unsigned int file_row = bmp->top_down ? y : bmp->height - 1 - y;
+    return bmp->file_byte_contents + bmp->pixel_array_start + file_row * bmp->row_size;
 }
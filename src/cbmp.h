@@ -1,16 +1,63 @@
 #ifndef CBMP_CBMP_H
 #define CBMP_CBMP_H
 
-#define BMP_WIDTH 950
-#define BMP_HEIGHT 950
+#include "image.h"
+#include "kernels.h"
+
 #define BMP_CHANNELS 3
 
+// Channel order of the pixels of a 3 channel Image, the same as in the file
+#define BLUE 0
+#define GREEN 1
+#define RED 2
+
+// Header template for writing, built by read_bitmap from the image it reads
+typedef struct BMP_data BMP;
+
 // Public function declarations
-void read_bitmap(
-    char *input_file_path,
-    unsigned char output_image_array[BMP_WIDTH][BMP_HEIGHT][BMP_CHANNELS]);
-void write_bitmap(
-    unsigned char input_image_array[BMP_WIDTH][BMP_HEIGHT][BMP_CHANNELS],
-    char *output_file_path);
+void read_bitmap(char *input_file_path, Image *output_image, BMP **output_template);
+void write_bitmap(Image *input_image, BMP *output_template, char *output_file_path);
+
+// The same split around the file: open_bitmap loads or maps the whole file, decode_bitmap_greyscale
+// reads it straight into its greyscale version and adds that to histogram, in a single pass,
+// and encode_bitmap fills the template's file buffer the way write_bitmap does, without
+// writing it out. Close with bclose. output_template may be NULL for decode_bitmap_greyscale
+// when no template is needed. open_bitmap reports a file it can not read, or one that is not
+// a valid bitmap, on stderr with its path and returns NULL; read_bitmap exits instead.
+BMP *open_bitmap(char *input_file_path);
+void decode_bitmap_greyscale(BMP *in_bmp, Image *greyscale_image, Histogram *histogram, BMP **output_template);
+void encode_bitmap(Image *input_image, BMP *output_template);
+
+// Pixels to paint over an open bitmap without decoding it. paint_pixel records a pixel to
+// change. encode_painted_bitmap turns the painted pixels into the output file, skipping those
+// outside the bitmap, and leaves the bitmap itself alone: its own bytes up to the end of the
+// pixel array with only the row spans around the painted pixels patched. write_painted_bitmap
+// does so and writes the pieces out with writev, so the untouched bytes are never copied.
+// Both forget the painted pixels; the paint and its buffers can go on to the next bitmap.
+typedef struct BMP_paint BitmapPaint;
+BitmapPaint *create_bitmap_paint(void);
+void paint_pixel(BitmapPaint *paint, int x, int y, unsigned char red, unsigned char green, unsigned char blue);
+void encode_painted_bitmap(BMP *bmp, BitmapPaint *paint);
+void write_painted_bitmap(BMP *bmp, BitmapPaint *paint, char *output_file_path);
+void free_bitmap_paint(BitmapPaint *paint);
+
+// Bitmap read or written a block of rows at a time, for images too large to hold at once.
+// Only the header stays in memory. Every call handles the image rows y0 to y0 + height - 1 of
+// the Image passed, which must be reserved at the bitmap's width. create_bitmap_stream
+// starts an output file with the header of source; its rows can be written in any order.
+typedef struct BMP_stream BMPStream;
+BMPStream *open_bitmap_stream(char *input_file_path);
+BMPStream *create_bitmap_stream(BMPStream *source, char *output_file_path);
+int bitmap_stream_width(BMPStream *stream);
+int bitmap_stream_height(BMPStream *stream);
+// Decodes rows into their greyscale version and adds that to histogram when it is not NULL
+void read_stream_greyscale(BMPStream *stream, int y0, Image *greyscale_image, Histogram *histogram);
+void read_stream_rows(BMPStream *stream, int y0, Image *output_image);
+// Writes the colours of input_image over source's rows, which must be the ones the last
+// read_stream_rows or read_stream_greyscale of source returned; row padding and alpha are the
+// source's, as write_painted_bitmap keeps them
+void write_stream_rows(BMPStream *stream, BMPStream *source, int y0, Image *input_image);
+void close_bitmap_stream(BMPStream *stream);
+void bclose(BMP *bmp);
 
 #endif // CBMP_CBMP_H
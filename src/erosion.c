@@ -0,0 +1,880 @@
+#include "erosion.h"
+#include "timing.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const Component EMPTY_COMPONENT = {.first = INT_MAX, .min_x = INT_MAX, .min_y = INT_MAX, .max_x = -1, .max_y = -1};
+
+static void push_index(IndexList *list, int index) {
+    if (list->amount == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 4096;
+        int *grown = realloc(list->items, capacity * sizeof(int));
+        if (!grown) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for erosion lists\n");
+            exit(1);
+        }
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->amount++] = index;
+}
+
+static void push_word(WordList *list, int index, uint64_t mask) {
+    if (list->amount == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 4096;
+        int *grown_index = realloc(list->index, capacity * sizeof(int));
+        if (grown_index) list->index = grown_index;
+        uint64_t *grown_mask = realloc(list->mask, capacity * sizeof(uint64_t));
+        if (grown_mask) list->mask = grown_mask;
+        if (!grown_index || !grown_mask) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for erosion lists\n");
+            exit(1);
+        }
+        list->capacity = capacity;
+    }
+    list->index[list->amount] = index;
+    list->mask[list->amount] = mask;
+    list->amount++;
+}
+
+static void push_spot(ErosionEngine *engine, int x, int y, int area, int first) {
+    if (engine->spots_amount == engine->spots_capacity) {
+        int capacity = engine->spots_capacity ? engine->spots_capacity * 2 : 256;
+        Spot *grown = realloc(engine->spots, capacity * sizeof(Spot));
+        if (!grown) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for spots\n");
+            exit(1);
+        }
+        engine->spots = grown;
+        engine->spots_capacity = capacity;
+    }
+    Spot *spot = &engine->spots[engine->spots_amount++];
+    spot->center.x = x;
+    spot->center.y = y;
+    spot->area = area;
+    spot->first = first;
+}
+
+static int compare_spots(const void *a, const void *b) { return ((const Spot *)a)->first - ((const Spot *)b)->first; }
+
+// Word of the neighbours at x + shift of every pixel in data[index]
+static inline uint64_t shifted_word(const uint64_t *data, int index, int shift) {
+    if (shift < 0) return (data[index] << 1) | (data[index - 1] >> 63);
+    if (shift > 0) return (data[index] >> 1) | (data[index + 1] << 63);
+    return data[index];
+}
+
+// Pixels of data[index] that survive an erosion by the 3x3 element whose rows above, at and
+// below the pixel are top, middle and bottom, with bit 2 for x - 1, bit 1 for x and bit 0 for
+// x + 1. Pixels are shifted in from the neighbouring word only and there is a single padding
+// row, so no neighbour needs a bounds check. Only ever called with constant rows, so the tests
+// fold away and each kernel keeps just the shifts and ANDs of its element.
+static inline __attribute__((always_inline)) uint64_t element_word(const uint64_t *data, int index, int words, int top, int middle, int bottom) {
+    uint64_t kept = data[index];
+    if (top & 4) kept &= shifted_word(data, index - words, -1);
+    if (top & 2) kept &= data[index - words];
+    if (top & 1) kept &= shifted_word(data, index - words, 1);
+    if (middle & 4) kept &= shifted_word(data, index, -1);
+    if (middle & 1) kept &= shifted_word(data, index, 1);
+    if (bottom & 4) kept &= shifted_word(data, index + words, -1);
+    if (bottom & 2) kept &= data[index + words];
+    if (bottom & 1) kept &= shifted_word(data, index + words, 1);
+    return kept;
+}
+
+// Defines the kernels of one 3x3 element, its rows given as for element_word. The losses of
+// the incremental erosion are decided against the image before the pass; the full pass reads
+// the neighbouring words, those of the rows just outside the tile included, straight from the
+// shared source plane.
+#define DEFINE_KERNEL(name, top, middle, bottom)                                                                                                     \
+    static void name##_losses(const uint64_t *data, int words, const IndexList *listed, WordList *eroded) {                                          \
+        for (size_t i = 0; i < listed->amount; ++i) {                                                                                               \
+            const int index = listed->items[i];                                                                                                     \
+            uint64_t lost = data[index] & ~element_word(data, index, words, top, middle, bottom);                                                   \
+            if (lost) push_word(eroded, index, lost);                                                                                               \
+        }                                                                                                                                           \
+    }                                                                                                                                               \
+    static void name##_pass(const BinaryImage *source, BinaryImage *target, const IndexList *occupied) {                                          \
+        const int words = source->words;                                                                                                            \
+        for (size_t i = 0; i < occupied->amount; ++i) {                                                                                             \
+            const int index = occupied->items[i];                                                                                                   \
+            target->data[index] = source->data[index] ? element_word(source->data, index, words, top, middle, bottom) : 0;                          \
+        }                                                                                                                                           \
+    }
+
+DEFINE_KERNEL(cross, 2, 7, 2)
+DEFINE_KERNEL(square, 7, 7, 7)
+
+// Kernels of the 3x3 passes, indexed by PassKind
+static const ErosionKernel KERNELS[] = {
+    [PASS_CROSS] = {cross_losses, cross_pass},
+    [PASS_SQUARE] = {square_losses, square_pass},
+};
+
+static void reserve_tiles(ErosionEngine *engine, int tiles_amount) {
+    if (tiles_amount <= engine->tiles_capacity) return;
+    Tile *grown = realloc(engine->tiles, tiles_amount * sizeof(Tile));
+    if (!grown) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for tiles\n");
+        exit(1);
+    }
+    memset(grown + engine->tiles_capacity, 0, (tiles_amount - engine->tiles_capacity) * sizeof(Tile));
+    engine->tiles = grown;
+    engine->tiles_capacity = tiles_amount;
+}
+
+BinaryImage *erosion_begin(ErosionEngine *engine, int width, int height, const StructuringElement *element, TilePool *pool) {
+    if (!binary_reserve(&engine->binary, width, height) || !binary_reserve(&engine->claimed, width, height) ||
+        !binary_reserve(&engine->filling, width, height)) {
+        return NULL;
+    }
+
+    // A zero-initialised element is the default 3x3 cross
+    if (element && element->passes_amount > 0) {
+        engine->element = *element;
+    } else {
+        element_build(SHAPE_DIAMOND, 3, &engine->element);
+    }
+    const ElementPass *first_pass = &engine->element.passes[0];
+
+    // Horizontal tiles of at least TILE_MIN_ROWS rows, one per thread
+    int tiles_amount = tile_pool_threads(pool);
+    if (tiles_amount > height / TILE_MIN_ROWS) tiles_amount = height / TILE_MIN_ROWS;
+    if (tiles_amount < 1) tiles_amount = 1;
+    reserve_tiles(engine, tiles_amount);
+    for (int t = 0; t < tiles_amount; ++t) {
+        engine->tiles[t].y0 = (int)((long long)height * t / tiles_amount);
+        engine->tiles[t].y1 = (int)((long long)height * (t + 1) / tiles_amount);
+    }
+    engine->tiles_amount = tiles_amount;
+    engine->pool = pool;
+    engine->tiled = tiles_amount > 1;
+    engine->incremental =
+        !engine->tiled && engine->element.passes_amount == 1 && (first_pass->kind == PASS_CROSS || first_pass->kind == PASS_SQUARE);
+
+    size_t plane_size = BINARY_PLANE_WORDS(&engine->binary);
+    if (engine->incremental) {
+        engine->kernel = &KERNELS[first_pass->kind];
+        if (plane_size > engine->queued_capacity) {
+            free(engine->queued);
+            engine->queued = malloc(plane_size * sizeof(unsigned int));
+            engine->queued_capacity = engine->queued ? plane_size : 0;
+            if (!engine->queued) return NULL;
+        }
+        memset(engine->queued, 0, plane_size * sizeof(unsigned int));
+    } else if (!binary_reserve(&engine->previous, width, height) || !binary_reserve(&engine->scratch, width, height)) {
+        return NULL;
+    }
+
+    engine->frontier.amount = 0;
+    engine->seeds.amount = 0;
+    engine->iteration = 0;
+    engine->spots_amount = 0;
+    return &engine->binary;
+}
+
+// Lists the words of the tile holding foreground
+static void occupy_tile(void *argument, int t) {
+    ErosionEngine *engine = argument;
+    Tile *tile = &engine->tiles[t];
+    const uint64_t *data = engine->binary.data;
+    const int words = engine->binary.words;
+    tile->occupied.amount = 0;
+    for (int y = tile->y0; y < tile->y1; ++y) {
+        int index = (y + 1) * words + 1;
+        for (int w = 0; w < words - 2; ++w, ++index) {
+            if (data[index]) push_index(&tile->occupied, index);
+        }
+    }
+}
+
+void erosion_collect(ErosionEngine *engine) {
+    const uint64_t *data = engine->binary.data;
+    const int words = engine->binary.words;
+    const int height = engine->binary.height;
+
+    if (!engine->incremental) {
+        tile_pool_run(engine->pool, occupy_tile, engine, engine->tiles_amount);
+    }
+    // Tiled detection labels the whole image every round
+    if (engine->tiled) return;
+
+    // Every foreground pixel seeds the first detection and every foreground word is on the first
+    // frontier, the first pass keeping those next to background
+    for (int y = 0; y < height; ++y) {
+        int index = (y + 1) * words + 1;
+        for (int w = 0; w < words - 2; ++w, ++index) {
+            if (!data[index]) continue;
+            push_word(&engine->seeds, index, data[index]);
+            if (engine->incremental) push_index(&engine->frontier, index);
+        }
+    }
+}
+
+// Seeds the next detection with the white 4-neighbours of the eroded pixels, carrying across
+// word edges. Only components next to an eroded pixel changed. The first detection keeps its
+// full seed list.
+static void collect_seeds(ErosionEngine *engine) {
+    const uint64_t *data = engine->binary.data;
+    const int words = engine->binary.words;
+    const WordList *eroded = &engine->eroded;
+    if (engine->iteration == 1) return;
+
+    engine->seeds.amount = 0;
+    for (size_t i = 0; i < eroded->amount; ++i) {
+        int index = eroded->index[i];
+        uint64_t lost = eroded->mask[i];
+        uint64_t mask;
+        if ((mask = ((lost << 1) | (lost >> 1)) & data[index])) push_word(&engine->seeds, index, mask);
+        if ((mask = (lost << 63) & data[index - 1])) push_word(&engine->seeds, index - 1, mask);
+        if ((mask = (lost >> 63) & data[index + 1])) push_word(&engine->seeds, index + 1, mask);
+        if ((mask = lost & data[index - words])) push_word(&engine->seeds, index - words, mask);
+        if ((mask = lost & data[index + words])) push_word(&engine->seeds, index + words, mask);
+    }
+}
+
+// One erosion by a 3x3 element, visiting only the frontier
+static void erode_frontier(ErosionEngine *engine) {
+    uint64_t *data = engine->binary.data;
+    const int words = engine->binary.words;
+    const unsigned int iteration = engine->iteration;
+    WordList *eroded = &engine->eroded;
+
+    // Decide everything against the image before this pass, then clear
+    eroded->amount = 0;
+    engine->kernel->losses(data, words, &engine->frontier, eroded);
+    for (size_t i = 0; i < eroded->amount; ++i) {
+        data[eroded->index[i]] &= ~eroded->mask[i];
+    }
+
+    // Only words that read a changed word through the element can erode next time
+    engine->next_frontier.amount = 0;
+    for (size_t i = 0; i < eroded->amount; ++i) {
+        int index = eroded->index[i];
+        for (int dy = -words; dy <= words; dy += words) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                int candidate = index + dy + dx;
+                if (data[candidate] && engine->queued[candidate] != iteration) {
+                    engine->queued[candidate] = iteration;
+                    push_index(&engine->next_frontier, candidate);
+                }
+            }
+        }
+    }
+
+    IndexList swap = engine->frontier;
+    engine->frontier = engine->next_frontier;
+    engine->next_frontier = swap;
+}
+
+// Erodes the occupied words in place by a horizontal line of length pixels. The AND over a
+// window is doubled up one shift at a time, so a line of length k costs log2(k) + 2 shifts per
+// word. A word outside the list is empty and, the line being centred, stays so.
+static void rows_pass(BinaryImage *image, int length, const IndexList *occupied) {
+    uint64_t *data = image->data;
+    const int radius = length / 2;
+
+    // Window [x, x + length) at x; reading the next word before it changes keeps this in place
+    int covered = 1;
+    while (covered < length) {
+        int shift = covered * 2 <= length ? covered : length - covered;
+        for (size_t i = 0; i < occupied->amount; ++i) {
+            const int index = occupied->items[i];
+            data[index] &= (data[index] >> shift) | (data[index + 1] << (64 - shift));
+        }
+        covered += shift;
+    }
+    // Centre the window, walking down so the previous word is still unchanged
+    for (size_t i = occupied->amount; i-- > 0;) {
+        const int index = occupied->items[i];
+        data[index] = (data[index] << radius) | (data[index - 1] >> (64 - radius));
+    }
+}
+
+static void reserve_lines(Tile *tile, size_t size) {
+    if (size <= tile->lines_capacity) return;
+    free(tile->prefix);
+    free(tile->suffix);
+    tile->prefix = malloc(size * sizeof(uint64_t));
+    tile->suffix = malloc(size * sizeof(uint64_t));
+    if (!tile->prefix || !tile->suffix) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for erosion lines\n");
+        exit(1);
+    }
+    tile->lines_capacity = size;
+}
+
+// Erodes rows y0..y1-1 of source into target by a vertical line of length pixels (van Herk /
+// Gil-Werman). The rows the windows cover, halo included, are split into blocks of length;
+// each block gets running ANDs from its start (prefix) and from its end (suffix), and every
+// window covers the tail of one block and the head of the next, so it is suffix[top] &
+// prefix[bottom]. Three ANDs per word, whatever the length.
+static void columns_pass(Tile *tile, const BinaryImage *source, BinaryImage *target, int length, int y0, int y1) {
+    const int words = source->words - 2;
+    const int height = source->height;
+    const int radius = length / 2;
+    const int first = y0 - radius > 0 ? y0 - radius : 0;
+    const int lines = (y1 + radius < height ? y1 + radius : height) - first;
+    reserve_lines(tile, (size_t)lines * words);
+    uint64_t *prefix = tile->prefix;
+    uint64_t *suffix = tile->suffix;
+
+    for (int i = 0; i < lines; ++i) {
+        const uint64_t *row = BINARY_ROW(source, first + i);
+        uint64_t *running = prefix + (size_t)i * words;
+        for (int w = 0; w < words; ++w) {
+            running[w] = i % length == 0 ? row[w] : running[w - words] & row[w];
+        }
+    }
+    for (int i = lines - 1; i >= 0; --i) {
+        const uint64_t *row = BINARY_ROW(source, first + i);
+        uint64_t *running = suffix + (size_t)i * words;
+        for (int w = 0; w < words; ++w) {
+            running[w] = i % length == length - 1 || i == lines - 1 ? row[w] : running[w + words] & row[w];
+        }
+    }
+
+    // Windows reaching past the top or bottom of the image see background
+    for (int y = y0; y < y1; ++y) {
+        uint64_t *row = BINARY_ROW(target, y);
+        if (y < radius || y + radius >= height) {
+            memset(row, 0, words * sizeof(uint64_t));
+            continue;
+        }
+        const uint64_t *top = suffix + (size_t)(y - radius - first) * words;
+        const uint64_t *bottom = prefix + (size_t)(y + radius - first) * words;
+        for (int w = 0; w < words; ++w) {
+            row[w] = top[w] & bottom[w];
+        }
+    }
+}
+
+static void swap_images(BinaryImage *a, BinaryImage *b) {
+    BinaryImage swap = *a;
+    *a = *b;
+    *b = swap;
+}
+
+static void snapshot_tile(void *argument, int t) {
+    ErosionEngine *engine = argument;
+    const Tile *tile = &engine->tiles[t];
+    for (size_t i = 0; i < tile->occupied.amount; ++i) {
+        const int index = tile->occupied.items[i];
+        engine->previous.data[index] = engine->binary.data[index];
+    }
+}
+
+static void pass_tile(void *argument, int t) {
+    ErosionEngine *engine = argument;
+    Tile *tile = &engine->tiles[t];
+    const ElementPass *pass = &engine->element.passes[engine->pass];
+    switch (pass->kind) {
+    case PASS_CROSS:
+    case PASS_SQUARE:
+        KERNELS[pass->kind].pass(&engine->binary, &engine->scratch, &tile->occupied);
+        break;
+    case PASS_ROWS:
+        rows_pass(&engine->binary, pass->length, &tile->occupied);
+        break;
+    case PASS_COLUMNS:
+        columns_pass(tile, &engine->binary, &engine->scratch, pass->length, tile->y0, tile->y1);
+        break;
+    }
+}
+
+// Lists the pixels the step eroded and drops the words it emptied, clearing them in the
+// scratch plane too, so that no plane holds foreground outside the list
+static void compare_tile(void *argument, int t) {
+    ErosionEngine *engine = argument;
+    Tile *tile = &engine->tiles[t];
+    IndexList *occupied = &tile->occupied;
+    tile->eroded.amount = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < occupied->amount; ++i) {
+        const int index = occupied->items[i];
+        uint64_t lost = engine->previous.data[index] & ~engine->binary.data[index];
+        if (lost) push_word(&tile->eroded, index, lost);
+        if (engine->binary.data[index]) {
+            occupied->items[kept++] = index;
+        } else {
+            engine->scratch.data[index] = 0;
+        }
+    }
+    occupied->amount = kept;
+}
+
+// One erosion by the whole element, one pass over the image per decomposed pass, each pass
+// split over the tiles. The eroded pixels are found against a copy of the image from before.
+static int erode_passes(ErosionEngine *engine) {
+    tile_pool_run(engine->pool, snapshot_tile, engine, engine->tiles_amount);
+    for (engine->pass = 0; engine->pass < engine->element.passes_amount; ++engine->pass) {
+        tile_pool_run(engine->pool, pass_tile, engine, engine->tiles_amount);
+        if (engine->element.passes[engine->pass].kind != PASS_ROWS) {
+            swap_images(&engine->binary, &engine->scratch);
+        }
+    }
+    tile_pool_run(engine->pool, compare_tile, engine, engine->tiles_amount);
+
+    int eroded_any = 0;
+    for (int t = 0; t < engine->tiles_amount; ++t) {
+        eroded_any |= engine->tiles[t].eroded.amount > 0;
+    }
+    // A single tile hands its list to the seeded detection
+    if (!engine->tiled) {
+        WordList swap = engine->eroded;
+        engine->eroded = engine->tiles[0].eroded;
+        engine->tiles[0].eroded = swap;
+    }
+    return eroded_any;
+}
+
+#ifdef TRACE
+// Pixels the last erosion step cleared, wherever the step left its eroded words
+static long long eroded_pixels(const ErosionEngine *engine) {
+    long long pixels = 0;
+    for (int t = 0; t < (engine->tiled ? engine->tiles_amount : 1); ++t) {
+        const WordList *eroded = engine->tiled ? &engine->tiles[t].eroded : &engine->eroded;
+        for (size_t i = 0; i < eroded->amount; ++i) {
+            pixels += __builtin_popcountll(eroded->mask[i]);
+        }
+    }
+    return pixels;
+}
+#endif
+
+int erosion_step(ErosionEngine *engine) {
+    START_TIMER();
+    engine->iteration++;
+    int eroded_any;
+    if (engine->incremental) {
+        erode_frontier(engine);
+        eroded_any = engine->eroded.amount > 0;
+    } else {
+        eroded_any = erode_passes(engine);
+    }
+    if (!engine->tiled) {
+        collect_seeds(engine);
+    }
+    TRACE_COUNT(TRACE_ITERATION, engine->iteration);
+    TRACE_COUNT(TRACE_ERODED, eroded_pixels(engine));
+    END_TIMER("erode_image");
+    return eroded_any;
+}
+
+static Component *push_component(ErosionEngine *engine) {
+    if (engine->components_amount == engine->components_capacity) {
+        int capacity = engine->components_capacity ? engine->components_capacity * 2 : 256;
+        Component *grown = realloc(engine->components, capacity * sizeof(Component));
+        if (!grown) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for components\n");
+            exit(1);
+        }
+        engine->components = grown;
+        engine->components_capacity = capacity;
+    }
+    return &engine->components[engine->components_amount++];
+}
+
+// Maximal run of set bits of word that contains bit
+static inline uint64_t run_at(uint64_t word, int bit) {
+    uint64_t above = ~(word >> bit);
+    uint64_t below = ~(word << (63 - bit));
+    int up = above ? __builtin_ctzll(above) : 64;
+    int down = below ? __builtin_clzll(below) : 64;
+    int length = up + down - 1;
+    return (length == 64 ? ~0ULL : (1ULL << length) - 1) << (bit - down + 1);
+}
+
+// Adds the run of data[index] to the statistics of component
+static void count_run(Component *component, const BinaryImage *image, int index, uint64_t run) {
+    const int words = image->words;
+    const int x = (index % words - 1) * 64 + __builtin_ctzll(run);
+    const int y = index / words - 1;
+    const int length = __builtin_popcountll(run);
+
+    if (x * image->height + y < component->first) component->first = x * image->height + y;
+    component->area += length;
+    component->sum_x += x * length + length * (length - 1) / 2;
+    component->sum_y += y * length;
+    if (x < component->min_x) component->min_x = x;
+    if (x + length - 1 > component->max_x) component->max_x = x + length - 1;
+    if (y < component->min_y) component->min_y = y;
+    if (y > component->max_y) component->max_y = y;
+}
+
+// Appends a run to the component being filled and adds it to its statistics
+static void add_run(ErosionEngine *engine, Component *component, int index, uint64_t run) {
+    engine->filling.data[index] |= run;
+    push_word(&engine->runs, index, run);
+    count_run(component, &engine->binary, index, run);
+}
+
+// Adds the run of data[index] containing bit unless this fill already has it. Returns 0 when
+// the fill has to give up: the run belongs to a fill from this round that gave up, or the
+// component has grown too large to be a spot.
+static int reach_run(ErosionEngine *engine, Component *component, int index, int bit) {
+    uint64_t run = run_at(engine->binary.data[index], bit);
+    if (engine->filling.data[index] & run) return 1;
+    // Complete fills cover their whole component, so this can only be one that gave up
+    if (engine->claimed.data[index] & run) return 0;
+    add_run(engine, component, index, run);
+    return component->area <= MAX_SPOT_SIZE;
+}
+
+// Labels the component of the given pixel one horizontal run at a time, 4-connected: a run
+// reaches the overlapping runs of the rows above and below and continues across word edges.
+// The runs are appended to engine->runs, which doubles as the queue of the fill. Returns
+// whether the component was labelled completely.
+static int fill_component(ErosionEngine *engine, Component *component, int pixel) {
+    const uint64_t *data = engine->binary.data;
+    const int words = engine->binary.words;
+
+    *component = EMPTY_COMPONENT;
+    component->runs_start = engine->runs.amount;
+    add_run(engine, component, pixel >> 6, run_at(data[pixel >> 6], pixel & 63));
+    if (component->area > MAX_SPOT_SIZE) return 0;
+
+    for (size_t r = component->runs_start; r < engine->runs.amount; ++r) {
+        const int index = engine->runs.index[r];
+        const uint64_t run = engine->runs.mask[r];
+        if ((run >> 63) && (data[index + 1] & 1) && !reach_run(engine, component, index + 1, 0)) return 0;
+        if ((run & 1) && (data[index - 1] >> 63) && !reach_run(engine, component, index - 1, 63)) return 0;
+        for (int side = index - words; side <= index + words; side += 2 * words) {
+            uint64_t touching = data[side] & run & ~engine->filling.data[side];
+            while (touching) {
+                int bit = __builtin_ctzll(touching);
+                if (!reach_run(engine, component, side, bit)) return 0;
+                touching &= ~run_at(data[side], bit);
+            }
+        }
+    }
+    return 1;
+}
+
+// Spots are the components of the right size that do not touch the image border
+static int is_spot(const Component *component, int width, int height) {
+    if (component->area < MIN_SPOT_SIZE || component->area > MAX_SPOT_SIZE) return 0;
+    return component->min_x > 0 && component->max_x < width - 1 && component->min_y > 0 && component->max_y < height - 1;
+}
+
+static void reserve_labels(Tile *tile, size_t amount) {
+    if (amount <= tile->labels_capacity) return;
+    int *grown_parent = realloc(tile->parent, amount * sizeof(int));
+    if (grown_parent) tile->parent = grown_parent;
+    Component *grown_components = realloc(tile->components, amount * sizeof(Component));
+    if (grown_components) tile->components = grown_components;
+    if (!grown_parent || !grown_components) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for components\n");
+        exit(1);
+    }
+    tile->labels_capacity = amount;
+}
+
+static int find_root(int *parent, int label) {
+    while (parent[label] != label) {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
+    }
+    return label;
+}
+
+// Joins the sets of a and b under the smaller root, so every label's parent is at most itself
+static void unite(int *parent, int a, int b) {
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+// Unites every segment of one row with the overlapping segments of the next. Both rows are in
+// x order, so walking them together and moving on from whichever segment ends first meets
+// every overlapping pair. Segment i of a list is label offset + i in parent.
+static void unite_rows(int *parent, const WordList *upper, int above, int above_end, int upper_offset, const WordList *lower, int below,
+                       int below_end, int lower_offset, int words) {
+    while (above < above_end && below < below_end) {
+        const int above_word = upper->index[above - upper_offset];
+        const int below_word = lower->index[below - lower_offset];
+        const uint64_t above_run = upper->mask[above - upper_offset];
+        const uint64_t below_run = lower->mask[below - lower_offset];
+        if (above_word + words == below_word && (above_run & below_run)) {
+            unite(parent, above, below);
+        }
+        const int above_last = (above_word + words) * 64 + 63 - __builtin_clzll(above_run);
+        const int below_last = below_word * 64 + 63 - __builtin_clzll(below_run);
+        if (above_last < below_last) {
+            above++;
+        } else {
+            below++;
+        }
+    }
+}
+
+// Splits the tile's rows into segments, joins them into components 4-connected and gathers
+// the statistics of each component at its root
+static void label_tile(void *argument, int t) {
+    ErosionEngine *engine = argument;
+    Tile *tile = &engine->tiles[t];
+    const BinaryImage *binary = &engine->binary;
+    const int words = binary->words;
+    const int rows = tile->y1 - tile->y0;
+
+    if (rows + 1 > tile->rows_capacity) {
+        int *grown = realloc(tile->row_start, (rows + 1) * sizeof(int));
+        if (!grown) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for tiles\n");
+            exit(1);
+        }
+        tile->row_start = grown;
+        tile->rows_capacity = rows + 1;
+    }
+    tile->segments.amount = 0;
+    int row = 0;
+    for (size_t i = 0; i < tile->occupied.amount; ++i) {
+        const int index = tile->occupied.items[i];
+        for (; row <= index / words - 1 - tile->y0; ++row) {
+            tile->row_start[row] = (int)tile->segments.amount;
+        }
+        uint64_t word = binary->data[index];
+        while (word) {
+            uint64_t run = run_at(word, __builtin_ctzll(word));
+            push_word(&tile->segments, index, run);
+            word &= ~run;
+        }
+    }
+    for (; row <= rows; ++row) {
+        tile->row_start[row] = (int)tile->segments.amount;
+    }
+
+    const int amount = (int)tile->segments.amount;
+    const int *index = tile->segments.index;
+    const uint64_t *mask = tile->segments.mask;
+    reserve_labels(tile, amount);
+    int *parent = tile->parent;
+    for (int s = 0; s < amount; ++s) {
+        parent[s] = s;
+    }
+    for (int s = 0; s + 1 < amount; ++s) {
+        // A run ending on bit 63 continues into the first segment of the next word
+        if ((mask[s] >> 63) && index[s + 1] == index[s] + 1 && (mask[s + 1] & 1)) unite(parent, s, s + 1);
+    }
+    for (int r = 0; r + 1 < rows; ++r) {
+        unite_rows(parent, &tile->segments, tile->row_start[r], tile->row_start[r + 1], 0, &tile->segments, tile->row_start[r + 1],
+                   tile->row_start[r + 2], 0, words);
+    }
+
+    // Parents never point up the list, so one pass in order points every segment at its root.
+    // Components too large to be spots stop counting, which keeps the sums in range.
+    for (int s = 0; s < amount; ++s) {
+        parent[s] = parent[parent[s]];
+        Component *component = &tile->components[parent[s]];
+        if (parent[s] == s) *component = EMPTY_COMPONENT;
+        if (component->area <= MAX_SPOT_SIZE) count_run(component, binary, index[s], mask[s]);
+    }
+}
+
+// Adds the statistics of from to those of into
+static void merge_components(Component *into, const Component *from) {
+    if (into->area + from->area > MAX_SPOT_SIZE) {
+        into->area = MAX_SPOT_SIZE + 1;
+        return;
+    }
+    into->area += from->area;
+    into->sum_x += from->sum_x;
+    into->sum_y += from->sum_y;
+    if (from->first < into->first) into->first = from->first;
+    if (from->min_x < into->min_x) into->min_x = from->min_x;
+    if (from->max_x > into->max_x) into->max_x = from->max_x;
+    if (from->min_y < into->min_y) into->min_y = from->min_y;
+    if (from->max_y > into->max_y) into->max_y = from->max_y;
+}
+
+static void remove_tile(void *argument, int t) {
+    ErosionEngine *engine = argument;
+    const Tile *tile = &engine->tiles[t];
+    for (size_t s = 0; s < tile->segments.amount; ++s) {
+        if (engine->accepted[engine->stitch[tile->base + s]]) {
+            engine->binary.data[tile->segments.index[s]] &= ~tile->segments.mask[s];
+        }
+    }
+}
+
+// Detection over tiles. Every component of the image is labelled each round: one that no
+// erosion touched was already turned down by an earlier round, so the spots found are the
+// same as from the seeded detection. The tiles label in parallel, their components are then
+// joined across the tile edges by comparing the last row of each tile with the first row of
+// the next, and the spots are removed in parallel again.
+static int detect_tiled(ErosionEngine *engine) {
+    const int width = engine->binary.width;
+    const int height = engine->binary.height;
+    const int words = engine->binary.words;
+    tile_pool_run(engine->pool, label_tile, engine, engine->tiles_amount);
+
+    int total = 0;
+    for (int t = 0; t < engine->tiles_amount; ++t) {
+        engine->tiles[t].base = total;
+        total += (int)engine->tiles[t].segments.amount;
+    }
+    if ((size_t)total > engine->stitch_capacity) {
+        free(engine->stitch);
+        free(engine->accepted);
+        engine->stitch = malloc(total * sizeof(int));
+        engine->accepted = malloc(total);
+        if (!engine->stitch || !engine->accepted) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for components\n");
+            exit(1);
+        }
+        engine->stitch_capacity = total;
+    }
+    int *stitch = engine->stitch;
+    for (int t = 0; t < engine->tiles_amount; ++t) {
+        const Tile *tile = &engine->tiles[t];
+        for (size_t s = 0; s < tile->segments.amount; ++s) {
+            stitch[tile->base + s] = tile->base + tile->parent[s];
+        }
+    }
+    for (int t = 0; t + 1 < engine->tiles_amount; ++t) {
+        const Tile *above = &engine->tiles[t];
+        const Tile *below = &engine->tiles[t + 1];
+        const int above_rows = above->y1 - above->y0;
+        unite_rows(stitch, &above->segments, above->base + above->row_start[above_rows - 1], above->base + above->row_start[above_rows], above->base,
+                   &below->segments, below->base + below->row_start[0], below->base + below->row_start[1], below->base, words);
+    }
+    memset(engine->accepted, 0, total);
+
+    // Roots stay at or below their labels across tiles too; fold every tile's components into
+    // the root in the tile it starts in
+    for (int t = 0; t < engine->tiles_amount; ++t) {
+        Tile *tile = &engine->tiles[t];
+        for (int s = 0; s < (int)tile->segments.amount; ++s) {
+            const int label = tile->base + s;
+            stitch[label] = stitch[stitch[label]];
+            if (tile->parent[s] != s || stitch[label] == label) continue;
+            Tile *root = tile;
+            while (root->base > stitch[label]) {
+                root--;
+            }
+            merge_components(&root->components[stitch[label] - root->base], &tile->components[s]);
+        }
+    }
+
+    engine->spots_amount = 0;
+    for (int t = 0; t < engine->tiles_amount; ++t) {
+        const Tile *tile = &engine->tiles[t];
+        for (int s = 0; s < (int)tile->segments.amount; ++s) {
+            const int label = tile->base + s;
+            if (stitch[label] != label) continue;
+            const Component *component = &tile->components[s];
+            if (!is_spot(component, width, height)) continue;
+            push_spot(engine, component->sum_x / component->area, component->sum_y / component->area, component->area, component->first);
+            engine->accepted[label] = 1;
+        }
+    }
+    tile_pool_run(engine->pool, remove_tile, engine, engine->tiles_amount);
+    return engine->spots_amount;
+}
+
+int erosion_detect(ErosionEngine *engine) {
+    START_TIMER();
+    uint64_t *data = engine->binary.data;
+    uint64_t *claimed = engine->claimed.data;
+    uint64_t *filling = engine->filling.data;
+    const int width = engine->binary.width;
+    const int height = engine->binary.height;
+
+    if (engine->tiled) {
+        detect_tiled(engine);
+        if (engine->spots_amount > 1) qsort(engine->spots, engine->spots_amount, sizeof(Spot), compare_spots);
+        TRACE_COUNT(TRACE_ITERATION, engine->iteration);
+        TRACE_COUNT(TRACE_CELLS, engine->spots_amount);
+        END_TIMER("detect_spots");
+        return engine->spots_amount;
+    }
+
+    // Label every component reached from a seed, collecting its statistics while filling
+    engine->runs.amount = 0;
+    engine->components_amount = 0;
+    for (size_t i = 0; i < engine->seeds.amount; ++i) {
+        uint64_t mask = engine->seeds.mask[i];
+        while (mask) {
+            int seed = engine->seeds.index[i] * 64 + __builtin_ctzll(mask);
+            mask &= mask - 1;
+            if (!BINARY_GET(data, seed) || BINARY_GET(claimed, seed)) continue;
+
+            Component *component = push_component(engine);
+            int complete = fill_component(engine, component, seed);
+            component->runs_end = engine->runs.amount;
+            for (size_t r = component->runs_start; r < component->runs_end; ++r) {
+                filling[engine->runs.index[r]] &= ~engine->runs.mask[r];
+                claimed[engine->runs.index[r]] |= engine->runs.mask[r];
+            }
+            if (!complete) engine->components_amount--;
+        }
+    }
+
+    engine->spots_amount = 0;
+    for (int i = 0; i < engine->components_amount; ++i) {
+        const Component *component = &engine->components[i];
+        if (!is_spot(component, width, height)) continue;
+
+        push_spot(engine, component->sum_x / component->area, component->sum_y / component->area, component->area, component->first);
+        for (size_t r = component->runs_start; r < component->runs_end; ++r) {
+            data[engine->runs.index[r]] &= ~engine->runs.mask[r];
+        }
+    }
+
+    // Every claimed pixel is in a run of this round, so only their words need clearing
+    for (size_t r = 0; r < engine->runs.amount; ++r) {
+        claimed[engine->runs.index[r]] = 0;
+    }
+
+    // Seeds come in frontier order, report spots in column order
+    if (engine->spots_amount > 1) qsort(engine->spots, engine->spots_amount, sizeof(Spot), compare_spots);
+
+    TRACE_COUNT(TRACE_ITERATION, engine->iteration);
+    TRACE_COUNT(TRACE_COMPONENTS, engine->components_amount);
+    TRACE_COUNT(TRACE_CELLS, engine->spots_amount);
+    END_TIMER("detect_spots");
+    return engine->spots_amount;
+}
+
+void erosion_free(ErosionEngine *engine) {
+    binary_free(&engine->binary);
+    binary_free(&engine->claimed);
+    binary_free(&engine->filling);
+    binary_free(&engine->previous);
+    binary_free(&engine->scratch);
+    for (int t = 0; t < engine->tiles_capacity; ++t) {
+        Tile *tile = &engine->tiles[t];
+        free(tile->eroded.index);
+        free(tile->eroded.mask);
+        free(tile->occupied.items);
+        free(tile->prefix);
+        free(tile->suffix);
+        free(tile->segments.index);
+        free(tile->segments.mask);
+        free(tile->parent);
+        free(tile->components);
+        free(tile->row_start);
+    }
+    free(engine->tiles);
+    free(engine->stitch);
+    free(engine->accepted);
+    free(engine->queued);
+    free(engine->frontier.items);
+    free(engine->next_frontier.items);
+    free(engine->eroded.index);
+    free(engine->eroded.mask);
+    free(engine->seeds.index);
+    free(engine->seeds.mask);
+    free(engine->runs.index);
+    free(engine->runs.mask);
+    free(engine->components);
+    free(engine->spots);
+    memset(engine, 0, sizeof(*engine));
+}
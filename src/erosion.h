@@ -0,0 +1,173 @@
+#ifndef EROSION_H
+#define EROSION_H
+
+#include "binary_image.h"
+#include "structuring_element.h"
+#include "tile_pool.h"
+
+#define TILE_MIN_ROWS 32
+
+// Components of MIN_SPOT_SIZE to MAX_SPOT_SIZE pixels are spots
+#define MAX_SPOT_SIZE 100
+#define MIN_SPOT_SIZE 5
+
+typedef struct {
+    int x;
+    int y;
+} Coordinates;
+
+// A detected cell: its centroid, its area in pixels and the position of its first pixel in
+// column order (x * height + y), the order cells are reported in
+typedef struct {
+    Coordinates center;
+    int area;
+    int first;
+} Spot;
+
+typedef struct {
+    int *items;
+    size_t amount;
+    size_t capacity;
+} IndexList;
+
+// Words of a BinaryImage together with a mask of the bits of interest in each
+typedef struct {
+    int *index;
+    uint64_t *mask;
+    size_t amount;
+    size_t capacity;
+} WordList;
+
+// Erosion by one 3x3 element, compiled once per element so that its inner loops hold the
+// element's shifts and ANDs unrolled instead of walking a table of offsets
+typedef struct {
+    // Appends the pixels of the listed words the element erodes to eroded
+    void (*losses)(const uint64_t *data, int words, const IndexList *listed, WordList *eroded);
+
+    // Erodes the occupied words of source into target
+    void (*pass)(const BinaryImage *source, BinaryImage *target, const IndexList *occupied);
+} ErosionKernel;
+
+// Statistics of a component labelled by erosion_detect, gathered run by run while filling.
+// Its runs are runs_start..runs_end-1 of the engine's run list.
+typedef struct {
+    int area;
+    int first;
+    int sum_x;
+    int sum_y;
+    int min_x;
+    int max_x;
+    int min_y;
+    int max_y;
+    size_t runs_start;
+    size_t runs_end;
+} Component;
+
+// Horizontal band of rows y0..y1-1 eroded and labelled by one thread, with its own scratch
+typedef struct {
+    int y0;
+    int y1;
+    WordList eroded;
+
+    // Words of the band that held foreground when the step began, in scan order. Full passes,
+    // snapshots and labelling only visit these; the planes are zero everywhere else, and
+    // words that empty out are dropped at the end of each step.
+    IndexList occupied;
+
+    // Running ANDs of the vertical line pass, over the band and the rows its windows reach
+    uint64_t *prefix;
+    uint64_t *suffix;
+    size_t lines_capacity;
+
+    // Horizontal runs within one word each, in row order, with the first of each row in
+    // row_start. parent links them into components; the statistics are kept per root.
+    WordList segments;
+    int *row_start;
+    int rows_capacity;
+    int *parent;
+    Component *components;
+    size_t labels_capacity;
+
+    // Number of segments in the tiles above, to number segments across the image
+    int base;
+} Tile;
+
+// Incremental erode/detect engine working on a bit-packed image. An erosion pass is a
+// handful of shifts and ANDs per 64 pixel word, and instead of rescanning the image each
+// pass only visits the words around the ones the previous pass changed. Detection only
+// labels the components next to freshly eroded pixels, a horizontal run at a time, so the
+// total work follows the foreground area rather than iterations x image size. Larger
+// structuring elements erode by their decomposed passes instead, at a cost per word that does
+// not depend on the element size, over the words that still hold foreground only (vertical
+// lines excepted). Given a pool with several threads, those passes and the detection are split
+// over horizontal tiles instead; see erosion_begin.
+typedef struct {
+    BinaryImage binary;
+
+    // Pixels flooded by this detection round, and by the fill in progress
+    BinaryImage claimed;
+    BinaryImage filling;
+
+    // Per word of the binary image: iteration it was last queued for erosion
+    unsigned int *queued;
+    size_t queued_capacity;
+
+    // Elements made of a single 3x3 pass erode incrementally with kernel. Others erode by full
+    // passes over the image, which keep the image from before the step in previous and work in
+    // scratch.
+    StructuringElement element;
+    int incremental;
+    const ErosionKernel *kernel;
+    BinaryImage previous;
+    BinaryImage scratch;
+    int pass;
+
+    // Full passes run tile by tile on pool; with more than one tile the image is tiled and
+    // detection labels every tile, then stitches the components across tile edges
+    Tile *tiles;
+    int tiles_amount;
+    int tiles_capacity;
+    TilePool *pool;
+    int tiled;
+    int *stitch;
+    unsigned char *accepted;
+    size_t stitch_capacity;
+
+    IndexList frontier;
+    IndexList next_frontier;
+    WordList eroded;
+    WordList seeds;
+
+    // Vertical runs of the components labelled by this detection round, and their statistics
+    WordList runs;
+    Component *components;
+    int components_amount;
+    int components_capacity;
+
+    unsigned int iteration;
+
+    // Spots found by the last erosion_detect, in column order of their first pixel
+    Spot *spots;
+    int spots_amount;
+    int spots_capacity;
+} ErosionEngine;
+
+// Prepares the engine for a width x height image and returns the binary image the thresholded
+// image must be written to before erosion_collect is called. Returns NULL on allocation failure.
+// pool may be NULL; otherwise the image is cut into up to one tile per thread of at least
+// TILE_MIN_ROWS rows, eroded and labelled in parallel with the same results as serially.
+BinaryImage *erosion_begin(ErosionEngine *engine, int width, int height, const StructuringElement *element, TilePool *pool);
+
+// Builds the first frontier and detection seeds from the thresholded image
+void erosion_collect(ErosionEngine *engine);
+
+// Erodes the image once with the whole structuring element. Returns whether any pixel changed.
+int erosion_step(ErosionEngine *engine);
+
+// Finds valid spots among the components touched by the last erosion, removes them from
+// the image and stores their centroids in engine->spots. Returns the number found.
+int erosion_detect(ErosionEngine *engine);
+
+void erosion_free(ErosionEngine *engine);
+
+#endif
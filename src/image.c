@@ -0,0 +1,37 @@
+#include "image.h"
+
+#include <stdlib.h>
+
+// Smallest power of two holding size, so images of similar size share a buffer
+static size_t size_class(size_t size) {
+    size_t capacity = 4096;
+    while (capacity < size) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+int image_reserve(Image *image, int width, int height, int channels) {
+    int stride = (width * channels + IMAGE_ROW_ALIGNMENT - 1) / IMAGE_ROW_ALIGNMENT * IMAGE_ROW_ALIGNMENT;
+    size_t size = (size_t)stride * height;
+    if (size > image->capacity) {
+        size_t capacity = size_class(size);
+        // Contents are not preserved, so there is nothing for realloc to copy
+        free(image->data);
+        image->data = aligned_alloc(IMAGE_ROW_ALIGNMENT, capacity);
+        image->capacity = image->data ? capacity : 0;
+        if (!image->data) return 0;
+    }
+
+    image->width = width;
+    image->height = height;
+    image->channels = channels;
+    image->stride = stride;
+    return 1;
+}
+
+void image_free(Image *image) {
+    free(image->data);
+    image->data = NULL;
+    image->capacity = 0;
+}
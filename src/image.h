@@ -0,0 +1,30 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+
+// Image with runtime dimensions, stored row by row from the top ([y][x][c]) like the rows of
+// a bitmap file. stride is the number of bytes between two neighbouring rows; rows are padded
+// to whole cache lines so every row starts on one. 3 channel images keep the bitmap's blue,
+// green, red order.
+typedef struct {
+    int width;
+    int height;
+    int channels;
+    int stride;
+    size_t capacity;
+    unsigned char *data;
+} Image;
+
+#define IMAGE_ROW_ALIGNMENT 64
+
+#define IMAGE_ROW(image, y) ((image)->data + (size_t)(y) * (image)->stride)
+#define IMAGE_AT(image, x, y) (IMAGE_ROW(image, y) + (size_t)(x) * (image)->channels)
+
+// Sets the dimensions, reusing the current buffer when it is large enough.
+// Returns 0 on allocation failure.
+int image_reserve(Image *image, int width, int height, int channels);
+
+void image_free(Image *image);
+
+#endif
@@ -0,0 +1,179 @@
+#include "kernels.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+static void greyscale_scalar(const unsigned char *rgb, unsigned char *grey, int count) {
+    for (int i = 0; i < count; ++i, rgb += 3) {
+        grey[i] = ((unsigned int)rgb[0] + rgb[1] + rgb[2]) >> 2;
+    }
+}
+
+static void threshold_scalar(const unsigned char *grey, int count, unsigned int threshold, uint64_t *words) {
+    for (int i = 0; i < count; i += 64) {
+        int run = count - i < 64 ? count - i : 64;
+        uint64_t word = 0;
+        for (int b = 0; b < run; ++b) {
+            word |= (uint64_t)(grey[i + b] > threshold) << b;
+        }
+        words[i >> 6] = word;
+    }
+}
+
+void histogram_clear(Histogram *histogram) { memset(histogram, 0, sizeof(*histogram)); }
+
+// Consecutive equal values would make each increment wait for the store of the previous one
+void histogram_add(Histogram *histogram, const unsigned char *data, size_t count) {
+    unsigned int(*banks)[256] = histogram->banks;
+    size_t i = 0;
+    for (; i + HISTOGRAM_BANKS <= count; i += HISTOGRAM_BANKS) {
+        banks[0][data[i]]++;
+        banks[1][data[i + 1]]++;
+        banks[2][data[i + 2]]++;
+        banks[3][data[i + 3]]++;
+    }
+    for (; i < count; ++i) {
+        banks[0][data[i]]++;
+    }
+}
+
+void histogram_total(const Histogram *histogram, uint64_t counts[256]) {
+    for (int v = 0; v < 256; ++v) {
+        counts[v] = 0;
+        for (int b = 0; b < HISTOGRAM_BANKS; ++b) {
+            counts[v] += histogram->banks[b][v];
+        }
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// Shuffles gathering channel c of 16 pixels from the k-th 16 bytes of their 48, as [c][k]
+#define GATHER_MASKS                                                                                                                 \
+    {{_mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),                                                    \
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1),                                                   \
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)},                                                  \
+     {_mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),                                                   \
+      _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1),                                                    \
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)},                                                  \
+     {_mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),                                                   \
+      _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1),                                                   \
+      _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)}}
+
+// SSE2 has no byte shuffle, so the deinterleave needs SSSE3
+__attribute__((target("ssse3"))) static void greyscale_ssse3(const unsigned char *rgb, unsigned char *grey, int count) {
+    const __m128i masks[3][3] = GATHER_MASKS;
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= count; i += 16, rgb += 48) {
+        __m128i chunk[3];
+        for (int k = 0; k < 3; ++k) {
+            chunk[k] = _mm_loadu_si128((const __m128i *)(rgb + 16 * k));
+        }
+        __m128i low = zero;
+        __m128i high = zero;
+        for (int c = 0; c < 3; ++c) {
+            __m128i channel = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(chunk[0], masks[c][0]), _mm_shuffle_epi8(chunk[1], masks[c][1])),
+                                           _mm_shuffle_epi8(chunk[2], masks[c][2]));
+            low = _mm_add_epi16(low, _mm_unpacklo_epi8(channel, zero));
+            high = _mm_add_epi16(high, _mm_unpackhi_epi8(channel, zero));
+        }
+        _mm_storeu_si128((__m128i *)(grey + i), _mm_packus_epi16(_mm_srli_epi16(low, 2), _mm_srli_epi16(high, 2)));
+    }
+    greyscale_scalar(rgb, grey + i, count - i);
+}
+
+// Unsigned compare through the signed one, by flipping the sign bits of both sides
+__attribute__((target("sse2"))) static void threshold_sse2(const unsigned char *grey, int count, unsigned int threshold, uint64_t *words) {
+    const __m128i flip = _mm_set1_epi8((char)0x80);
+    const __m128i limit = _mm_xor_si128(_mm_set1_epi8((char)threshold), flip);
+    int i = 0;
+    for (; i + 64 <= count; i += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 4; ++k) {
+            __m128i values = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(grey + i + 16 * k)), flip);
+            word |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(values, limit)) << (16 * k);
+        }
+        words[i >> 6] = word;
+    }
+    if (i < count) {
+        threshold_scalar(grey + i, count - i, threshold, words + (i >> 6));
+    }
+}
+
+// Two groups of 16 pixels side by side, one per 128 bit lane, so the in-lane shuffles of
+// the SSSE3 version still apply
+__attribute__((target("avx2"))) static void greyscale_avx2(const unsigned char *rgb, unsigned char *grey, int count) {
+    const __m128i masks128[3][3] = GATHER_MASKS;
+    __m256i masks[3][3];
+    for (int c = 0; c < 3; ++c) {
+        for (int k = 0; k < 3; ++k) {
+            masks[c][k] = _mm256_broadcastsi128_si256(masks128[c][k]);
+        }
+    }
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 32 <= count; i += 32, rgb += 96) {
+        __m256i chunk[3];
+        for (int k = 0; k < 3; ++k) {
+            __m128i first = _mm_loadu_si128((const __m128i *)(rgb + 16 * k));
+            __m128i second = _mm_loadu_si128((const __m128i *)(rgb + 48 + 16 * k));
+            chunk[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+        }
+        __m256i low = zero;
+        __m256i high = zero;
+        for (int c = 0; c < 3; ++c) {
+            __m256i channel = _mm256_or_si256(
+                _mm256_or_si256(_mm256_shuffle_epi8(chunk[0], masks[c][0]), _mm256_shuffle_epi8(chunk[1], masks[c][1])),
+                _mm256_shuffle_epi8(chunk[2], masks[c][2]));
+            low = _mm256_add_epi16(low, _mm256_unpacklo_epi8(channel, zero));
+            high = _mm256_add_epi16(high, _mm256_unpackhi_epi8(channel, zero));
+        }
+        _mm256_storeu_si256((__m256i *)(grey + i), _mm256_packus_epi16(_mm256_srli_epi16(low, 2), _mm256_srli_epi16(high, 2)));
+    }
+    greyscale_ssse3(rgb, grey + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void threshold_avx2(const unsigned char *grey, int count, unsigned int threshold, uint64_t *words) {
+    const __m256i flip = _mm256_set1_epi8((char)0x80);
+    const __m256i limit = _mm256_xor_si256(_mm256_set1_epi8((char)threshold), flip);
+    int i = 0;
+    for (; i + 64 <= count; i += 64) {
+        __m256i low = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(grey + i)), flip);
+        __m256i high = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(grey + i + 32)), flip);
+        uint64_t word = (unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(low, limit));
+        word |= (uint64_t)(unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(high, limit)) << 32;
+        words[i >> 6] = word;
+    }
+    if (i < count) {
+        threshold_scalar(grey + i, count - i, threshold, words + (i >> 6));
+    }
+}
+
+#endif
+
+static Kernels selected = {"scalar", greyscale_scalar, threshold_scalar};
+static pthread_once_t selected_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void) {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        selected = (Kernels){"avx2", greyscale_avx2, threshold_avx2};
+    } else if (__builtin_cpu_supports("ssse3")) {
+        selected = (Kernels){"ssse3", greyscale_ssse3, threshold_sse2};
+    } else if (__builtin_cpu_supports("sse2")) {
+        selected = (Kernels){"sse2", greyscale_scalar, threshold_sse2};
+    }
+#endif
+}
+
+const Kernels *kernels(void) {
+    pthread_once(&selected_once, select_kernels);
+    return &selected;
+}
@@ -0,0 +1,33 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming per-pixel kernels of the front end. Every implementation is bit-exact with
+// the scalar one; kernels() picks the widest one the CPU supports.
+typedef struct {
+    const char *name;
+
+    // grey[i] = (sum of the 3 channels of rgb pixel i) >> 2, for count pixels
+    void (*greyscale)(const unsigned char *rgb, unsigned char *grey, int count);
+
+    // Packs grey[i] > threshold into bit i % 64 of words[i / 64], for count pixels
+    void (*threshold)(const unsigned char *grey, int count, unsigned int threshold, uint64_t *words);
+} Kernels;
+
+const Kernels *kernels(void);
+
+#define HISTOGRAM_BANKS 4
+
+// Byte histogram counted in interleaved banks, so that runs of equal values do not wait
+// on each other's increments. histogram_total sums the banks into the plain counts.
+typedef struct {
+    unsigned int banks[HISTOGRAM_BANKS][256];
+} Histogram;
+
+void histogram_clear(Histogram *histogram);
+void histogram_add(Histogram *histogram, const unsigned char *data, size_t count);
+void histogram_total(const Histogram *histogram, uint64_t counts[256]);
+
+#endif
@@ -0,0 +1,241 @@
+#include "pipeline.h"
+
+#include "kernels.h"
+#include "timing.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_COORDINATES 4700
+
+void add_cell(Pipeline *pipeline, const Spot *spot, int iteration) {
+    if (pipeline->coordinates_amount == pipeline->coordinates_capacity) {
+        int capacity = pipeline->coordinates_capacity ? pipeline->coordinates_capacity * 2 : INITIAL_COORDINATES;
+        Coordinates *grown = realloc(pipeline->coordinates, capacity * sizeof(Coordinates));
+        if (grown) pipeline->coordinates = grown;
+        int *grown_areas = realloc(pipeline->areas, capacity * sizeof(int));
+        if (grown_areas) pipeline->areas = grown_areas;
+        int *grown_iterations = realloc(pipeline->iterations, capacity * sizeof(int));
+        if (grown_iterations) pipeline->iterations = grown_iterations;
+        if (!grown || !grown_areas || !grown_iterations) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for coordinates\n");
+            return;
+        }
+        pipeline->coordinates_capacity = capacity;
+    }
+    pipeline->coordinates[pipeline->coordinates_amount] = spot->center;
+    pipeline->areas[pipeline->coordinates_amount] = spot->area;
+    pipeline->iterations[pipeline->coordinates_amount] = iteration;
+    pipeline->coordinates_amount += 1;
+}
+
+unsigned int otsu_threshold(const uint64_t histogram[256], uint64_t total_pixels) {
+    START_TIMER();
+    // step 1, the histogram comes with the greyscale image
+
+    // step 2, sum the intensities and count pixels
+    uint64_t pixels_sum = 0;
+    for (int i = 0; i <= 255; ++i) {
+        pixels_sum += i * histogram[i];
+    }
+
+    // step 3, initialise variables
+    double max_variance = 0.0;
+    unsigned int optimal_threshold = 0;
+    uint64_t background_count = 0;
+    uint64_t background_sum = 0;
+
+    // step 4, go through potential thresholds
+    for (int i = 0; i <= 255; ++i) {
+        background_count = background_count + histogram[i];
+        background_sum = background_sum + i * histogram[i];
+
+        uint64_t foreground_count = total_pixels - background_count;
+        if (background_count == 0 || foreground_count == 0) {
+            continue;
+        }
+
+        double background_mean = (double)background_sum / (double)background_count;
+        double foreground_mean = (double)(pixels_sum - background_sum) / (double)foreground_count;
+
+        double variance =
+            (double)background_count * (double)foreground_count * ((background_mean - foreground_mean) * (background_mean - foreground_mean));
+        if (variance > max_variance) {
+            max_variance = variance;
+            optimal_threshold = i;
+        }
+    }
+
+    END_TIMER("otsu_threshold");
+    return optimal_threshold;
+}
+
+// Packs the pixels brighter than threshold into a binary image of the same size
+void apply_threshold(unsigned int threshold, Image *input_image, BinaryImage *output_image) {
+    START_TIMER();
+    const Kernels *k = kernels();
+    for (int y = 0; y < input_image->height; ++y) {
+        k->threshold(IMAGE_ROW(input_image, y), input_image->width, threshold, BINARY_ROW(output_image, y));
+    }
+    TRACE_COUNT(TRACE_PIXELS, (long long)input_image->width * input_image->height);
+    END_TIMER("apply_threshold");
+}
+
+// Erodes the image until it is empty, counting the spots that break off on the way
+static int segment_erosion(Pipeline *pipeline, unsigned int threshold) {
+    Image *greyscale_image = &pipeline->greyscale_image;
+    ErosionEngine *erosion = &pipeline->erosion;
+
+    BinaryImage *binary_image = erosion_begin(erosion, greyscale_image->width, greyscale_image->height, &pipeline->element, pipeline->pool);
+    if (!binary_image) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for binary_image\n");
+        exit(1);
+    }
+    apply_threshold(threshold, greyscale_image, binary_image);
+    if (pipeline->stage_writer) {
+        stage_writer_submit(pipeline->stage_writer, binary_image, pipeline->out_bmp, 0);
+    }
+    erosion_collect(erosion);
+
+    int index = 0;
+    int total_cells = 0;
+    int eroded_any = FALSE;
+
+    do {
+        eroded_any = erosion_step(erosion);
+        int cells_found = erosion_detect(erosion);
+        for (int i = 0; i < cells_found; ++i) {
+            add_cell(pipeline, &erosion->spots[i], (int)erosion->iteration);
+        }
+        total_cells += cells_found;
+
+        if (pipeline->stage_writer) {
+            stage_writer_submit(pipeline->stage_writer, binary_image, pipeline->out_bmp, index);
+        }
+
+        index++;
+    } while (eroded_any);
+
+    return total_cells;
+}
+
+// Splits the foreground into cells in one watershed pass
+static int segment_watershed(Pipeline *pipeline, unsigned int threshold) {
+    Image *greyscale_image = &pipeline->greyscale_image;
+    WatershedEngine *watershed = &pipeline->watershed;
+
+    BinaryImage *binary_image = watershed_begin(watershed, greyscale_image->width, greyscale_image->height);
+    if (!binary_image) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for binary_image\n");
+        exit(1);
+    }
+    apply_threshold(threshold, greyscale_image, binary_image);
+    if (pipeline->stage_writer) {
+        stage_writer_submit(pipeline->stage_writer, binary_image, pipeline->out_bmp, 0);
+    }
+
+    int total_cells = watershed_count(watershed);
+    for (int i = 0; i < total_cells; ++i) {
+        add_cell(pipeline, &watershed->spots[i], 0);
+    }
+    return total_cells;
+}
+
+void pipeline_decode(Pipeline *pipeline, BMP *in_bmp) {
+    START_TIMER();
+    histogram_clear(&pipeline->histogram);
+    // Only the stage writer encodes whole images, through the template
+    decode_bitmap_greyscale(in_bmp, &pipeline->greyscale_image, &pipeline->histogram, pipeline->stage_writer ? &pipeline->out_bmp : NULL);
+    TRACE_COUNT(TRACE_PIXELS, (long long)pipeline->greyscale_image.width * pipeline->greyscale_image.height);
+    END_TIMER("decode_greyscale");
+}
+
+unsigned int pipeline_threshold(Pipeline *pipeline) {
+    uint64_t counts[256];
+    histogram_total(&pipeline->histogram, counts);
+    return otsu_threshold(counts, (uint64_t)pipeline->greyscale_image.width * pipeline->greyscale_image.height);
+}
+
+int pipeline_segment(Pipeline *pipeline, unsigned int threshold) {
+    pipeline->coordinates_amount = 0;
+    if (pipeline->engine == ENGINE_WATERSHED) {
+        return segment_watershed(pipeline, threshold);
+    }
+    return segment_erosion(pipeline, threshold);
+}
+
+void pipeline_annotate(Pipeline *pipeline) {
+    START_TIMER();
+    if (!pipeline->paint) {
+        pipeline->paint = create_bitmap_paint();
+    }
+    const int half_hypotenuse = CROSS_HYPOTENUSE >> 1;
+    for (int z = 0; z < pipeline->coordinates_amount; z++) {
+        const Coordinates *centre = &pipeline->coordinates[z];
+        for (int x = 0; x < CROSS_HYPOTENUSE; ++x) {
+            int y = centre->y + x - half_hypotenuse;
+            paint_pixel(pipeline->paint, centre->x + x - half_hypotenuse, y, 255, 0, 0);
+            paint_pixel(pipeline->paint, centre->x - x + half_hypotenuse, y, 255, 0, 0);
+        }
+    }
+    TRACE_COUNT(TRACE_CELLS, pipeline->coordinates_amount);
+    END_TIMER("pipeline_annotate");
+}
+
+void pipeline_write(Pipeline *pipeline, BMP *in_bmp, char *output_path) {
+    START_TIMER();
+    write_painted_bitmap(in_bmp, pipeline->paint, output_path);
+    END_TIMER("write_bitmap");
+}
+
+void pipeline_report(Pipeline *pipeline, char *input_path, unsigned int threshold, const ReportOptions *report_options) {
+    // The whole report of the image goes out in one write
+    ImageReport report = {.path = input_path,
+                          .threshold = threshold,
+                          .cells = pipeline->coordinates_amount,
+                          .coordinates = pipeline->coordinates,
+                          .areas = pipeline->areas,
+                          .iterations = pipeline->iterations};
+    report_image(&pipeline->report, report_options, &report);
+    report_write(&pipeline->report);
+}
+
+int count_cells(Pipeline *pipeline, char *input_path, char *output_path, const ReportOptions *report_options) {
+    // Load image from file, straight to greyscale. The file stays open for the annotated output.
+    BMP *in_bmp = open_bitmap(input_path);
+    if (!in_bmp) return -1;
+    pipeline_decode(pipeline, in_bmp);
+
+    unsigned int binary_threshold = pipeline_threshold(pipeline);
+    int total_cells = pipeline_segment(pipeline, binary_threshold);
+
+    pipeline_report(pipeline, input_path, binary_threshold, report_options);
+
+    if (output_path) {
+        // Only the pixels under the crosses change, the rest of the file goes out as it was read
+        pipeline_annotate(pipeline);
+        pipeline_write(pipeline, in_bmp, output_path);
+    }
+    bclose(in_bmp);
+
+    return total_cells;
+}
+
+void pipeline_free(Pipeline *pipeline) {
+    image_free(&pipeline->greyscale_image);
+    erosion_free(&pipeline->erosion);
+    watershed_free(&pipeline->watershed);
+    free(pipeline->coordinates);
+    free(pipeline->areas);
+    free(pipeline->iterations);
+    report_free(&pipeline->report);
+    if (pipeline->out_bmp) {
+        bclose(pipeline->out_bmp);
+    }
+    if (pipeline->paint) {
+        free_bitmap_paint(pipeline->paint);
+    }
+    memset(pipeline, 0, sizeof(*pipeline));
+}
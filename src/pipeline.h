@@ -0,0 +1,88 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "cbmp.h"
+#include "erosion.h"
+#include "report.h"
+#include "stage_writer.h"
+#include "watershed.h"
+
+#define WHITE 255
+#define BLACK 0
+
+#define TRUE 1
+#define FALSE 0
+
+// Length of the diagonals of the cross drawn over every cell
+#define CROSS_HYPOTENUSE 20
+
+// Segmentation engines, chosen with --engine
+typedef enum {
+    ENGINE_ERODE,
+    ENGINE_WATERSHED,
+} Engine;
+
+// Everything one run of the pipeline touches. Each worker owns one Pipeline and its
+// buffers act as that worker's arena: reserved by the first image of a size class
+// and reused for every later image. Zero-initialise before first use.
+typedef struct {
+    Image greyscale_image;
+    Histogram histogram;
+
+    // Binary image and segmentation, only the selected engine is used. The erode engine
+    // erodes by element, a zero element being the 3x3 cross.
+    Engine engine;
+    StructuringElement element;
+    ErosionEngine erosion;
+    WatershedEngine watershed;
+
+    // Threads the erosion of one image is split over when set; not owned
+    TilePool *pool;
+
+    // Cells found in the last image: centres, areas and the erosion step each was found after
+    Coordinates *coordinates;
+    int *areas;
+    int *iterations;
+    int coordinates_amount;
+    int coordinates_capacity;
+    ReportBuffer report;
+
+    // Header template for writing, follows the last image read
+    BMP *out_bmp;
+    // Crosses to paint over the bitmap read, made by the first annotated image
+    BitmapPaint *paint;
+
+    // Receives the binary image of every erosion stage when set; not owned
+    StageWriter *stage_writer;
+} Pipeline;
+
+// The threshold that best splits histogram into two classes. The sums are 64-bit, so the
+// threshold of an image only depends on the proportions of its histogram, whatever its size.
+unsigned int otsu_threshold(const uint64_t histogram[256], uint64_t total_pixels);
+void apply_threshold(unsigned int threshold, Image *input_image, BinaryImage *output_image);
+
+// The stages of count_cells, for callers that time them one by one. pipeline_decode reads the
+// greyscale image and its histogram from an open bitmap. pipeline_segment thresholds the
+// greyscale image and finds the cells, leaving their centres in pipeline->coordinates, and
+// pipeline_annotate paints their crosses into pipeline->paint, which pipeline_write writes
+// over the bitmap to output_path.
+void pipeline_decode(Pipeline *pipeline, BMP *in_bmp);
+unsigned int pipeline_threshold(Pipeline *pipeline);
+int pipeline_segment(Pipeline *pipeline, unsigned int threshold);
+void pipeline_annotate(Pipeline *pipeline);
+void pipeline_write(Pipeline *pipeline, BMP *in_bmp, char *output_path);
+
+// Records a found cell, with the erosion step it was found after
+void add_cell(Pipeline *pipeline, const Spot *spot, int iteration);
+
+// Reports the cells in pipeline->coordinates to stdout as report_options says, in one write
+void pipeline_report(Pipeline *pipeline, char *input_path, unsigned int threshold, const ReportOptions *report_options);
+
+// Runs the full pipeline on one image, reports its results to stdout as report_options says
+// and returns the number of cells found, or -1 when the image can not be read, which is
+// reported on stderr. output_path may be NULL to skip the annotated image.
+int count_cells(Pipeline *pipeline, char *input_path, char *output_path, const ReportOptions *report_options);
+
+void pipeline_free(Pipeline *pipeline);
+
+#endif
@@ -0,0 +1,181 @@
+#include "report.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *FORMAT_NAMES[] = {"text", "json", "csv", "binary"};
+
+static void reserve(ReportBuffer *buffer, size_t extra) {
+    if (buffer->length + extra <= buffer->capacity) return;
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->length + extra) {
+        capacity *= 2;
+    }
+    char *grown = realloc(buffer->data, capacity);
+    if (!grown) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for the report\n");
+        exit(1);
+    }
+    buffer->data = grown;
+    buffer->capacity = capacity;
+}
+
+static void append(ReportBuffer *buffer, const char *data, size_t length) {
+    reserve(buffer, length);
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+static void append_format(ReportBuffer *buffer, const char *format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, arguments);
+    va_end(arguments);
+    if (length < 0) return;
+    if (buffer->length + length >= buffer->capacity) {
+        reserve(buffer, length + 1);
+        va_start(arguments, format);
+        vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, arguments);
+        va_end(arguments);
+    }
+    buffer->length += length;
+}
+
+static void append_u32(ReportBuffer *buffer, uint32_t value) {
+    unsigned char bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+    append(buffer, (const char *)bytes, sizeof(bytes));
+}
+
+static void append_json_string(ReportBuffer *buffer, const char *text) {
+    append(buffer, "\"", 1);
+    for (const unsigned char *c = (const unsigned char *)text; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            char escaped[2] = {'\\', *c};
+            append(buffer, escaped, 2);
+        } else if (*c < 0x20) {
+            append_format(buffer, "\\u%04x", *c);
+        } else {
+            append(buffer, (const char *)c, 1);
+        }
+    }
+    append(buffer, "\"", 1);
+}
+
+// Quotes the field when it holds a comma, quote or line break, doubling inner quotes
+static void append_csv_field(ReportBuffer *buffer, const char *text) {
+    if (!strpbrk(text, ",\"\r\n")) {
+        append(buffer, text, strlen(text));
+        return;
+    }
+    append(buffer, "\"", 1);
+    for (const char *c = text; *c; ++c) {
+        append(buffer, c, 1);
+        if (*c == '"') append(buffer, c, 1);
+    }
+    append(buffer, "\"", 1);
+}
+
+static void report_text(ReportBuffer *buffer, const ReportOptions *options, const ImageReport *report) {
+    if (!options->quiet) {
+        append_format(buffer, "[ %-5s ] binary_threshold (otsu_threshold) = %d\n", "DEBUG", report->threshold);
+        for (int i = 0; i < report->cells; ++i) {
+            append_format(buffer, "[ %-5s ] White pixel detected at position: (%d, %d)\n", "LOG", report->coordinates[i].x, report->coordinates[i].y);
+        }
+    }
+    append_format(buffer, "%d cells found in sample image '%s'\n", report->cells, report->path);
+}
+
+static void report_json(ReportBuffer *buffer, const ReportOptions *options, const ImageReport *report) {
+    append(buffer, "{\"image\":", 9);
+    append_json_string(buffer, report->path);
+    if (options->quiet) {
+        append_format(buffer, ",\"cells\":%d}\n", report->cells);
+        return;
+    }
+    append_format(buffer, ",\"threshold\":%u,\"cells\":%d,\"spots\":[", report->threshold, report->cells);
+    for (int i = 0; i < report->cells; ++i) {
+        append_format(buffer, "%s{\"x\":%d,\"y\":%d,\"area\":%d,\"iteration\":%d}", i ? "," : "", report->coordinates[i].x, report->coordinates[i].y,
+                      report->areas[i], report->iterations[i]);
+    }
+    append(buffer, "]}\n", 3);
+}
+
+static void report_csv(ReportBuffer *buffer, const ReportOptions *options, const ImageReport *report) {
+    if (options->quiet || report->cells == 0) {
+        append_csv_field(buffer, report->path);
+        append_format(buffer, options->quiet ? ",%d\n" : ",%d,,,,\n", report->cells);
+        return;
+    }
+    for (int i = 0; i < report->cells; ++i) {
+        append_csv_field(buffer, report->path);
+        append_format(buffer, ",%d,%d,%d,%d,%d\n", report->cells, report->coordinates[i].x, report->coordinates[i].y, report->areas[i],
+                      report->iterations[i]);
+    }
+}
+
+static void report_binary(ReportBuffer *buffer, const ReportOptions *options, const ImageReport *report) {
+    size_t path_length = strlen(report->path);
+    int records = options->quiet ? 0 : report->cells;
+    append_u32(buffer, (uint32_t)path_length);
+    append(buffer, report->path, path_length);
+    append_u32(buffer, report->threshold);
+    append_u32(buffer, (uint32_t)report->cells);
+    append_u32(buffer, (uint32_t)records);
+    for (int i = 0; i < records; ++i) {
+        append_u32(buffer, (uint32_t)report->coordinates[i].x);
+        append_u32(buffer, (uint32_t)report->coordinates[i].y);
+        append_u32(buffer, (uint32_t)report->areas[i]);
+        append_u32(buffer, (uint32_t)report->iterations[i]);
+    }
+}
+
+int report_parse_format(const char *name, ReportFormat *format) {
+    for (int i = 0; i < (int)(sizeof(FORMAT_NAMES) / sizeof(FORMAT_NAMES[0])); ++i) {
+        if (strcmp(name, FORMAT_NAMES[i]) == 0) {
+            *format = (ReportFormat)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void report_begin(const ReportOptions *options) {
+    if (options->format == FORMAT_CSV) {
+        printf(options->quiet ? "image,cells\n" : "image,cells,x,y,area,iteration\n");
+        fflush(stdout);
+    }
+}
+
+void report_image(ReportBuffer *buffer, const ReportOptions *options, const ImageReport *report) {
+    buffer->length = 0;
+    reserve(buffer, 1);
+    switch (options->format) {
+    case FORMAT_TEXT:
+        report_text(buffer, options, report);
+        break;
+    case FORMAT_JSON:
+        report_json(buffer, options, report);
+        break;
+    case FORMAT_CSV:
+        report_csv(buffer, options, report);
+        break;
+    case FORMAT_BINARY:
+        report_binary(buffer, options, report);
+        break;
+    }
+}
+
+void report_write(const ReportBuffer *buffer) {
+    fwrite(buffer->data, 1, buffer->length, stdout);
+    fflush(stdout);
+}
+
+void report_free(ReportBuffer *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
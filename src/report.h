@@ -0,0 +1,56 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "erosion.h"
+
+#include <stddef.h>
+
+// Output formats, chosen with --format
+typedef enum {
+    FORMAT_TEXT,   // the readable log: threshold, one line per cell and the count
+    FORMAT_JSON,   // one JSON object per image and line
+    FORMAT_CSV,    // one row per cell, after a single header row
+    FORMAT_BINARY, // little-endian records, see report_image
+} ReportFormat;
+
+// format, and quiet to leave out everything but the count of each image
+typedef struct {
+    ReportFormat format;
+    int quiet;
+} ReportOptions;
+
+// Results of one image as they are reported. coordinates, areas and iterations hold one entry
+// per cell; iteration is the erosion step the cell was found after, 0 for the watershed.
+typedef struct {
+    const char *path;
+    unsigned int threshold;
+    int cells;
+    const Coordinates *coordinates;
+    const int *areas;
+    const int *iterations;
+} ImageReport;
+
+// Growable output buffer, so each image goes out in a single write
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} ReportBuffer;
+
+// Parses the name of a format. Returns 0 when it is not one.
+int report_parse_format(const char *name, ReportFormat *format);
+
+// Writes whatever precedes the first image, the CSV header row, to stdout
+void report_begin(const ReportOptions *options);
+
+// Formats the results of one image into buffer, replacing its contents. A binary record is
+// u32 path length, the path bytes, u32 threshold, u32 cells, u32 number of cell records
+// (0 when quiet), then per cell i32 x, y, area and iteration.
+void report_image(ReportBuffer *buffer, const ReportOptions *options, const ImageReport *report);
+
+// Writes the buffer to stdout in one call
+void report_write(const ReportBuffer *buffer);
+
+void report_free(ReportBuffer *buffer);
+
+#endif
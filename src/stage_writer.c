@@ -0,0 +1,141 @@
+#include "stage_writer.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define STAGE_SLOTS 4
+
+typedef struct {
+    BinaryImage image;
+    BMP *template;
+    int index;
+} StageSlot;
+
+struct StageWriter {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    // Slots head..tail-1 (modulo STAGE_SLOTS) are queued; head only moves once a stage is written
+    StageSlot slots[STAGE_SLOTS];
+    unsigned int head;
+    unsigned int tail;
+    int stop;
+
+    char directory[256];
+    Image rgb_image;
+};
+
+static void write_stage(StageWriter *writer, StageSlot *slot) {
+    BinaryImage *image = &slot->image;
+    Image *rgb_image = &writer->rgb_image;
+    if (!image_reserve(rgb_image, image->width, image->height, BMP_CHANNELS)) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for stage %d\n", slot->index);
+        return;
+    }
+
+    const int width = image->width;
+    const int height = image->height;
+    for (int y = 0; y < height; ++y) {
+        const uint64_t *row = BINARY_ROW(image, y);
+        unsigned char *pixel = IMAGE_ROW(rgb_image, y);
+        for (int x = 0; x < width; ++x, pixel += BMP_CHANNELS) {
+            memset(pixel, ((row[x >> 6] >> (x & 63)) & 1) ? 255 : 0, BMP_CHANNELS);
+        }
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/stage_%d.bmp", writer->directory, slot->index);
+    write_bitmap(rgb_image, slot->template, path);
+}
+
+static void *writer_thread(void *argument) {
+    StageWriter *writer = argument;
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (writer->head == writer->tail && !writer->stop) {
+            pthread_cond_wait(&writer->changed, &writer->lock);
+        }
+        if (writer->head == writer->tail) break;
+
+        // The slot stays reserved until head moves past it, so it can be written unlocked
+        StageSlot *slot = &writer->slots[writer->head % STAGE_SLOTS];
+        pthread_mutex_unlock(&writer->lock);
+        write_stage(writer, slot);
+        pthread_mutex_lock(&writer->lock);
+
+        writer->head++;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+StageWriter *stage_writer_start(const char *directory) {
+    struct stat info;
+    if (mkdir(directory, 0777) != 0 && (errno != EEXIST || stat(directory, &info) != 0 || !S_ISDIR(info.st_mode))) {
+        fprintf(stderr, "[ERROR] Could not create stage directory '%s': %s\n", directory, errno == EEXIST ? "Not a directory" : strerror(errno));
+        return NULL;
+    }
+
+    StageWriter *writer = calloc(1, sizeof(StageWriter));
+    if (!writer) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for the stage writer\n");
+        return NULL;
+    }
+    snprintf(writer->directory, sizeof(writer->directory), "%s", directory);
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+
+    if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0) {
+        fprintf(stderr, "[ERROR] Could not start the stage writer thread\n");
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->changed);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+void stage_writer_submit(StageWriter *writer, BinaryImage *image, BMP *template, int index) {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->tail - writer->head == STAGE_SLOTS) {
+        pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    StageSlot *slot = &writer->slots[writer->tail % STAGE_SLOTS];
+    pthread_mutex_unlock(&writer->lock);
+
+    // Only this thread moves tail, so the free slot can be filled unlocked
+    if (!binary_reserve(&slot->image, image->width, image->height)) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for stage %d\n", index);
+        return;
+    }
+    memcpy(slot->image.data, image->data, BINARY_PLANE_WORDS(image) * sizeof(uint64_t));
+    slot->template = template;
+    slot->index = index;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->tail++;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+void stage_writer_finish(StageWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    for (int i = 0; i < STAGE_SLOTS; ++i) {
+        binary_free(&writer->slots[i].image);
+    }
+    image_free(&writer->rgb_image);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->changed);
+    free(writer);
+}
@@ -0,0 +1,22 @@
+#ifndef STAGE_WRITER_H
+#define STAGE_WRITER_H
+
+#include "binary_image.h"
+#include "cbmp.h"
+
+// Writes the binary image of every erosion stage to <directory>/stage_<n>.bmp from a
+// background thread. Submitted stages are copied into a small ring of reusable slots,
+// so the erosion loop only waits when the disk falls a whole ring behind.
+typedef struct StageWriter StageWriter;
+
+// Creates directory when it does not exist yet and starts the writer thread.
+// Reports the problem and returns NULL when either fails.
+StageWriter *stage_writer_start(const char *directory);
+
+// Queues image as stage number index, written with the header of template
+void stage_writer_submit(StageWriter *writer, BinaryImage *image, BMP *template, int index);
+
+// Writes what is still queued, stops the thread and frees the writer
+void stage_writer_finish(StageWriter *writer);
+
+#endif
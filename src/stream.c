@@ -0,0 +1,423 @@
+#include "stream.h"
+
+#include "kernels.h"
+#include "timing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Rows decoded per read, bounding the greyscale and RGB buffers
+#define STREAM_BLOCK_ROWS 64
+
+// A cell found by a window, in image coordinates. first is the position of its first pixel in
+// column order over the whole image, which can outgrow an int.
+typedef struct {
+    Spot spot;
+    int iteration;
+    long long first;
+} StreamCell;
+
+typedef struct {
+    StreamCell *items;
+    int amount;
+    int capacity;
+} StreamCells;
+
+// Pixels of a window that may differ from the whole image, as the rows beyond an open edge,
+// one that is not an image edge, are missing. An erosion step spreads them by the reach of the
+// element, but only over foreground: background stays background whatever lies beyond. A
+// detection spreads them over the small components they touch, which may be taken or left
+// wrongly; a component too large for a spot in the window is larger still in the image.
+// extents counts the rows from each open edge that hold dirty pixels.
+typedef struct {
+    BinaryImage dirty;
+    BinaryImage spread;
+    int open[2];
+    int extents[2];
+    int *pixels;
+    int pixels_capacity;
+} WindowDirt;
+
+static void push_cell(StreamCells *cells, const StreamCell *cell) {
+    if (cells->amount == cells->capacity) {
+        int capacity = cells->capacity ? cells->capacity * 2 : 1024;
+        StreamCell *grown = realloc(cells->items, capacity * sizeof(StreamCell));
+        if (!grown) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for the cells\n");
+            exit(1);
+        }
+        cells->items = grown;
+        cells->capacity = capacity;
+    }
+    cells->items[cells->amount++] = *cell;
+}
+
+// The order count_cells finds cells in: by erosion step, then column order of the first pixel
+static int compare_cells(const void *a, const void *b) {
+    const StreamCell *x = a;
+    const StreamCell *y = b;
+    if (x->iteration != y->iteration) return x->iteration - y->iteration;
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+static int compare_rows(const void *a, const void *b) { return ((const Coordinates *)a)->y - ((const Coordinates *)b)->y; }
+
+static void reserve_block(Image *image, int width, int rows, int channels) {
+    if (!image_reserve(image, width, rows, channels)) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for the strip\n");
+        exit(1);
+    }
+}
+
+// First pass: the histogram of the whole image, for the same threshold as count_cells
+static unsigned int stream_threshold(Pipeline *pipeline, BMPStream *stream) {
+    START_TIMER();
+    const int width = bitmap_stream_width(stream);
+    const int height = bitmap_stream_height(stream);
+    histogram_clear(&pipeline->histogram);
+    for (int y = 0; y < height; y += STREAM_BLOCK_ROWS) {
+        reserve_block(&pipeline->greyscale_image, width, height - y < STREAM_BLOCK_ROWS ? height - y : STREAM_BLOCK_ROWS, 1);
+        read_stream_greyscale(stream, y, &pipeline->greyscale_image, &pipeline->histogram);
+    }
+    uint64_t counts[256];
+    histogram_total(&pipeline->histogram, counts);
+    END_TIMER("stream_threshold");
+    return otsu_threshold(counts, (uint64_t)width * height);
+}
+
+static int row_empty(const BinaryImage *image, int y) {
+    const uint64_t *row = BINARY_ROW(image, y);
+    for (int i = 0; i < image->words - 2; ++i) {
+        if (row[i]) return 0;
+    }
+    return 1;
+}
+
+// Word i of dirty row y, the rows beyond an open edge being all dirty
+static uint64_t dirty_word(const WindowDirt *dirt, int y, int i) {
+    if (y < 0) return dirt->open[0] ? ~(uint64_t)0 : 0;
+    if (y >= dirt->dirty.height) return dirt->open[1] ? ~(uint64_t)0 : 0;
+    return BINARY_ROW(&dirt->dirty, y)[i];
+}
+
+// Rows from the top and bottom edge whose pixels may be dirty, so far and one step further
+static void dirt_ranges(const WindowDirt *dirt, int grow, int ranges[2][2]) {
+    const int rows = dirt->dirty.height;
+    ranges[0][0] = 0;
+    ranges[0][1] = dirt->open[0] ? (dirt->extents[0] + grow < rows ? dirt->extents[0] + grow : rows) : 0;
+    ranges[1][0] = dirt->open[1] ? (rows - dirt->extents[1] - grow > 0 ? rows - dirt->extents[1] - grow : 0) : rows;
+    ranges[1][1] = rows;
+}
+
+static void update_extents(WindowDirt *dirt, int ranges[2][2]) {
+    for (int y = ranges[0][1] - 1; y >= ranges[0][0] && y >= dirt->extents[0]; --y) {
+        if (!row_empty(&dirt->dirty, y)) {
+            dirt->extents[0] = y + 1;
+            break;
+        }
+    }
+    const int rows = dirt->dirty.height;
+    for (int y = ranges[1][0]; y < ranges[1][1] && rows - y > dirt->extents[1]; ++y) {
+        if (!row_empty(&dirt->dirty, y)) {
+            dirt->extents[1] = rows - y;
+            break;
+        }
+    }
+}
+
+// Before an erosion step: every foreground pixel within reach of a dirty one turns dirty
+static void dirt_step(WindowDirt *dirt, const BinaryImage *image, int reach) {
+    int ranges[2][2];
+    dirt_ranges(dirt, reach, ranges);
+    const int words = image->words - 2;
+    for (int r = 0; r < 2; ++r) {
+        for (int y = ranges[r][0]; y < ranges[r][1]; ++y) {
+            const uint64_t *foreground = BINARY_ROW(image, y);
+            uint64_t *spread = BINARY_ROW(&dirt->spread, y);
+            for (int i = 0; i < words; ++i) {
+                uint64_t left = 0, centre = 0, right = 0;
+                for (int dy = -reach; dy <= reach; ++dy) {
+                    left |= dirty_word(dirt, y + dy, i - 1);
+                    centre |= dirty_word(dirt, y + dy, i);
+                    right |= dirty_word(dirt, y + dy, i + 1);
+                }
+                uint64_t near = centre;
+                for (int s = 1; s <= reach; ++s) {
+                    near |= centre << s | centre >> s | left >> (64 - s) | right << (64 - s);
+                }
+                spread[i] = near & foreground[i];
+            }
+        }
+    }
+    for (int r = 0; r < 2; ++r) {
+        for (int y = ranges[r][0]; y < ranges[r][1]; ++y) {
+            uint64_t *row = BINARY_ROW(&dirt->dirty, y);
+            uint64_t *spread = BINARY_ROW(&dirt->spread, y);
+            for (int i = 0; i < words; ++i) {
+                row[i] |= spread[i];
+                spread[i] = 0;
+            }
+        }
+    }
+    update_extents(dirt, ranges);
+}
+
+// Gathers the 4-connected clean foreground around start into dirt->pixels, marking it in
+// spread, and stops past MAX_SPOT_SIZE pixels. Returns the number gathered.
+static int gather_component(WindowDirt *dirt, const BinaryImage *image, int start) {
+    const int offsets[4] = {-1, 1, -64 * image->words, 64 * image->words};
+    int amount = 0;
+    BINARY_SET(dirt->spread.data, start);
+    dirt->pixels[amount++] = start;
+    for (int head = 0; head < amount && amount <= MAX_SPOT_SIZE; ++head) {
+        for (int n = 0; n < 4 && amount <= MAX_SPOT_SIZE; ++n) {
+            int index = dirt->pixels[head] + offsets[n];
+            if (BINARY_GET(image->data, index) && !BINARY_GET(dirt->dirty.data, index) && !BINARY_GET(dirt->spread.data, index)) {
+                BINARY_SET(dirt->spread.data, index);
+                dirt->pixels[amount++] = index;
+            }
+        }
+    }
+    return amount;
+}
+
+// Before a detection: the clean components 4-connected to a dirty pixel turn dirty, unless
+// they are too large to be spots
+static void dirt_detect(WindowDirt *dirt, const BinaryImage *image) {
+    if (dirt->pixels_capacity == 0) {
+        dirt->pixels = malloc((MAX_SPOT_SIZE + 1) * sizeof(int));
+        if (!dirt->pixels) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for the window\n");
+            exit(1);
+        }
+        dirt->pixels_capacity = MAX_SPOT_SIZE + 1;
+    }
+    int ranges[2][2];
+    dirt_ranges(dirt, 1, ranges);
+    const int words = image->words - 2;
+    for (int r = 0; r < 2; ++r) {
+        for (int y = ranges[r][0]; y < ranges[r][1]; ++y) {
+            const uint64_t *foreground = BINARY_ROW(image, y);
+            const uint64_t *dirty = BINARY_ROW(&dirt->dirty, y);
+            for (int i = 0; i < words; ++i) {
+                uint64_t near = dirty_word(dirt, y - 1, i) | dirty_word(dirt, y + 1, i) | dirty[i] << 1 | dirty[i] >> 1 | dirty[i - 1] >> 63 |
+                                dirty[i + 1] << 63;
+                uint64_t seeds = foreground[i] & ~dirty[i] & near;
+                while (seeds) {
+                    int bit = __builtin_ctzll(seeds);
+                    seeds &= seeds - 1;
+                    int start = BINARY_INDEX(image, i * 64 + bit, y);
+                    if (BINARY_GET(dirt->dirty.data, start) || BINARY_GET(dirt->spread.data, start)) continue;
+                    int amount = gather_component(dirt, image, start);
+                    for (int p = 0; p < amount; ++p) {
+                        if (amount <= MAX_SPOT_SIZE) BINARY_SET(dirt->dirty.data, dirt->pixels[p]);
+                        BINARY_CLEAR(dirt->spread.data, dirt->pixels[p]);
+                    }
+                }
+            }
+        }
+    }
+    // A component reaches at most a spot height past the rows it was found from
+    dirt_ranges(dirt, MAX_SPOT_SIZE + 1, ranges);
+    update_extents(dirt, ranges);
+}
+
+int stream_min_halo(const StructuringElement *element) { return MAX_SPOT_SIZE + element->size / 2 + 1; }
+
+// Erodes and detects the window over rows w0 to w1 - 1 and keeps the cells whose first pixel
+// lies in rows s0 to s1 - 1. Those cells and the ones of the whole image there are the same as
+// long as no dirty pixel comes within a spot height of the strip. Returns 0 when none did, or
+// else stops at once and returns a bit per edge whose dirt did, 1 for the top and 2 for the
+// bottom; the cells kept so far are then not to be trusted.
+static int segment_window(Pipeline *pipeline, BMPStream *stream, WindowDirt *dirt, unsigned int threshold, int w0, int w1, int s0, int s1,
+                           StreamCells *cells) {
+    const int width = bitmap_stream_width(stream);
+    const int height = bitmap_stream_height(stream);
+    const int rows = w1 - w0;
+    ErosionEngine *erosion = &pipeline->erosion;
+    BinaryImage *binary_image = erosion_begin(erosion, width, rows, &pipeline->element, pipeline->pool);
+    if (!binary_image || !binary_reserve(&dirt->dirty, width, rows) || !binary_reserve(&dirt->spread, width, rows)) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for binary_image\n");
+        exit(1);
+    }
+    dirt->open[0] = w0 > 0;
+    dirt->open[1] = w1 < height;
+    dirt->extents[0] = 0;
+    dirt->extents[1] = 0;
+    const int limits[2] = {s0 - w0 - MAX_SPOT_SIZE, w1 - s1 - MAX_SPOT_SIZE};
+
+    const Kernels *k = kernels();
+    for (int y = w0; y < w1; y += STREAM_BLOCK_ROWS) {
+        int block_rows = w1 - y < STREAM_BLOCK_ROWS ? w1 - y : STREAM_BLOCK_ROWS;
+        reserve_block(&pipeline->greyscale_image, width, block_rows, 1);
+        read_stream_greyscale(stream, y, &pipeline->greyscale_image, NULL);
+        for (int i = 0; i < block_rows; ++i) {
+            k->threshold(IMAGE_ROW(&pipeline->greyscale_image, i), width, threshold, BINARY_ROW(binary_image, y - w0 + i));
+        }
+    }
+    erosion_collect(erosion);
+
+    const int reach = erosion->element.size / 2;
+    int eroded_any = FALSE;
+    do {
+        dirt_step(dirt, binary_image, reach);
+        eroded_any = erosion_step(erosion);
+        dirt_detect(dirt, binary_image);
+        int reached = 0;
+        for (int e = 0; e < 2; ++e) {
+            if (dirt->open[e] && dirt->extents[e] > limits[e]) {
+                reached |= 1 << e;
+            }
+        }
+        if (reached) return reached;
+
+        int cells_found = erosion_detect(erosion);
+        for (int i = 0; i < cells_found; ++i) {
+            const Spot *spot = &erosion->spots[i];
+            int x = spot->first / rows;
+            int y = w0 + spot->first % rows;
+            if (y < s0 || y >= s1) continue;
+            StreamCell cell = {.spot = *spot, .iteration = (int)erosion->iteration, .first = (long long)x * height + y};
+            cell.spot.center.y += w0;
+            push_cell(cells, &cell);
+        }
+    } while (eroded_any);
+    return 0;
+}
+
+// Second pass: every strip with its halo, one window at a time. A window whose missing rows
+// reach the strip is done again with twice the halo on that side, which ends at the latest
+// when the window reaches the image edge, as there are no missing rows there.
+static void stream_cells(Pipeline *pipeline, BMPStream *stream, unsigned int threshold, const StreamOptions *options, StreamCells *cells) {
+    START_TIMER();
+    const int height = bitmap_stream_height(stream);
+    const int strip = options->strip_rows;
+    const int halo = options->halo_rows;
+
+    WindowDirt dirt = {0};
+
+    for (int s0 = 0; s0 < height; s0 += strip) {
+        int s1 = height - s0 < strip ? height : s0 + strip;
+        int halos[2] = {halo, halo};
+        const int kept = cells->amount;
+        for (;;) {
+            int w0 = s0 > halos[0] ? s0 - halos[0] : 0;
+            int w1 = height - s1 < halos[1] ? height : s1 + halos[1];
+            int reached = segment_window(pipeline, stream, &dirt, threshold, w0, w1, s0, s1, cells);
+            if (!reached) break;
+            cells->amount = kept;
+            for (int e = 0; e < 2; ++e) {
+                if (reached & (1 << e)) {
+                    halos[e] = halos[e] > height / 2 ? height : halos[e] * 2;
+                }
+            }
+        }
+    }
+    binary_free(&dirt.dirty);
+    binary_free(&dirt.spread);
+    free(dirt.pixels);
+    END_TIMER("stream_cells");
+}
+
+// Draws a red cross with diagonals of hypotenuse pixels over every coordinate, clipped to the image
+static void cross(Image *image, Coordinates *coordinates, int coordinates_amount, int hypotenuse) {
+    int half_hypotenuse = hypotenuse >> 1;
+
+    for (int z = 0; z < coordinates_amount; z++) {
+        for (int x = 0; x < hypotenuse; ++x) {
+            int x1 = coordinates[z].x + x - half_hypotenuse;
+            int y1 = coordinates[z].y + x - half_hypotenuse;
+            int x2 = coordinates[z].x - x + half_hypotenuse;
+            int y2 = coordinates[z].y + x - half_hypotenuse;
+
+            // Draws first diagonal
+            if (x1 >= 0 && x1 < image->width && y1 >= 0 && y1 < image->height) {
+                unsigned char *pixel = IMAGE_AT(image, x1, y1);
+                pixel[RED] = 255;
+                pixel[GREEN] = 0;
+                pixel[BLUE] = 0;
+            }
+
+            // Draws second diagonal
+            if (x2 >= 0 && x2 < image->width && y2 >= 0 && y2 < image->height) {
+                unsigned char *pixel = IMAGE_AT(image, x2, y2);
+                pixel[RED] = 255;
+                pixel[GREEN] = 0;
+                pixel[BLUE] = 0;
+            }
+        }
+    }
+}
+
+// Third pass: copies the image a block of rows at a time, drawing the crosses that reach the block
+static void stream_annotate(Pipeline *pipeline, BMPStream *stream, char *output_path) {
+    START_TIMER();
+    const int width = bitmap_stream_width(stream);
+    const int height = bitmap_stream_height(stream);
+    const int half = CROSS_HYPOTENUSE / 2;
+    BMPStream *output = create_bitmap_stream(stream, output_path);
+    Image block = {0};
+
+    // Crosses by centre row, so each block only looks at the ones near it
+    const int amount = pipeline->coordinates_amount;
+    Coordinates *centres = malloc((amount + 1) * sizeof(Coordinates));
+    if (!centres) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for the crosses\n");
+        exit(1);
+    }
+    memcpy(centres, pipeline->coordinates, amount * sizeof(Coordinates));
+    qsort(centres, amount, sizeof(Coordinates), compare_rows);
+
+    int first = 0;
+    for (int y = 0; y < height; y += STREAM_BLOCK_ROWS) {
+        int block_rows = height - y < STREAM_BLOCK_ROWS ? height - y : STREAM_BLOCK_ROWS;
+        reserve_block(&block, width, block_rows, BMP_CHANNELS);
+        read_stream_rows(stream, y, &block);
+
+        while (first < amount && centres[first].y + half < y) {
+            first++;
+        }
+        int last = first;
+        while (last < amount && centres[last].y - half < y + block_rows) {
+            centres[last++].y -= y;
+        }
+        cross(&block, centres + first, last - first, CROSS_HYPOTENUSE);
+        for (int i = first; i < last; ++i) {
+            centres[i].y += y;
+        }
+        write_stream_rows(output, stream, y, &block);
+    }
+
+    free(centres);
+    image_free(&block);
+    close_bitmap_stream(output);
+    END_TIMER("stream_annotate");
+}
+
+int stream_segment(Pipeline *pipeline, char *input_path, char *output_path, const StreamOptions *options, unsigned int *threshold) {
+    BMPStream *stream = open_bitmap_stream(input_path);
+    *threshold = stream_threshold(pipeline, stream);
+
+    StreamCells cells = {0};
+    stream_cells(pipeline, stream, *threshold, options, &cells);
+    qsort(cells.items, cells.amount, sizeof(StreamCell), compare_cells);
+    pipeline->coordinates_amount = 0;
+    for (int i = 0; i < cells.amount; ++i) {
+        add_cell(pipeline, &cells.items[i].spot, cells.items[i].iteration);
+    }
+    free(cells.items);
+
+    if (output_path) {
+        stream_annotate(pipeline, stream, output_path);
+    }
+    close_bitmap_stream(stream);
+    return pipeline->coordinates_amount;
+}
+
+int stream_count_cells(Pipeline *pipeline, char *input_path, char *output_path, const StreamOptions *options, const ReportOptions *report_options) {
+    unsigned int threshold;
+    int total_cells = stream_segment(pipeline, input_path, output_path, options, &threshold);
+    pipeline_report(pipeline, input_path, threshold, report_options);
+    return total_cells;
+}
@@ -0,0 +1,34 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "pipeline.h"
+
+#define STREAM_STRIP_ROWS 1024
+#define STREAM_HALO_ROWS 256
+
+// Rows of the image each window reports cells for, and rows read above and below them
+typedef struct {
+    int strip_rows;
+    int halo_rows;
+} StreamOptions;
+
+// Smallest halo_rows a window can work with: the first erosion step already spreads the
+// missing rows by the element's reach, and a strip edge must stay a spot height beyond that.
+// Images with foreground across the strip edges need more, which the windows read as needed.
+int stream_min_halo(const StructuringElement *element);
+
+// Counts the cells of an image too large to hold in memory with the erode engine, reading it
+// a strip at a time. A first pass builds the histogram for the Otsu threshold, a second
+// thresholds and erodes each strip together with halo_rows rows on either side and keeps the
+// cells whose first pixel lies in the strip, and a third draws the crosses into output_path
+// strip by strip unless it is NULL. Where the erosion near a window edge could reach the strip,
+// the window is done again with twice the halo on that side, until it can not. Memory follows
+// the largest window, (strip_rows + 2 * halo_rows) x width unless one grew, not the image.
+// The cells are left in pipeline->coordinates in the order count_cells finds them, and
+// *threshold receives the threshold.
+int stream_segment(Pipeline *pipeline, char *input_path, char *output_path, const StreamOptions *options, unsigned int *threshold);
+
+// stream_segment followed by the report of count_cells. Returns the number of cells found.
+int stream_count_cells(Pipeline *pipeline, char *input_path, char *output_path, const StreamOptions *options, const ReportOptions *report_options);
+
+#endif
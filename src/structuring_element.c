@@ -0,0 +1,66 @@
+#include "structuring_element.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *SHAPE_NAMES[] = {"diamond", "square", "disc"};
+
+static void add_pass(StructuringElement *element, PassKind kind, int length) {
+    element->passes[element->passes_amount].kind = kind;
+    element->passes[element->passes_amount].length = length;
+    element->passes_amount++;
+}
+
+int element_build(ElementShape shape, int size, StructuringElement *element) {
+    if (size < ELEMENT_MIN_SIZE || size > ELEMENT_MAX_SIZE || size % 2 == 0) return 0;
+    const int radius = size / 2;
+
+    element->shape = shape;
+    element->size = size;
+    element->passes_amount = 0;
+    switch (shape) {
+    case SHAPE_DIAMOND:
+        for (int i = 0; i < radius; ++i) {
+            add_pass(element, PASS_CROSS, 3);
+        }
+        break;
+    case SHAPE_SQUARE:
+        if (size == 3) {
+            add_pass(element, PASS_SQUARE, 3);
+        } else {
+            add_pass(element, PASS_ROWS, size);
+            add_pass(element, PASS_COLUMNS, size);
+        }
+        break;
+    case SHAPE_DISC: {
+        // Squares reach radius along the diagonal, crosses radius / 2; sqrt(2) - 1 of the
+        // steps as squares puts the octagon's diagonal edge on the circle
+        int squares = (int)lround(radius * (sqrt(2.0) - 1.0));
+        for (int i = 0; i < radius; ++i) {
+            add_pass(element, (i + 1) * squares / radius > i * squares / radius ? PASS_SQUARE : PASS_CROSS, 3);
+        }
+        break;
+    }
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+int element_parse(const char *spec, StructuringElement *element) {
+    const char *colon = strchr(spec, ':');
+    size_t name_length = colon ? (size_t)(colon - spec) : strlen(spec);
+    int size = 3;
+    if (colon) {
+        char *end;
+        size = (int)strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0') return 0;
+    }
+    for (int shape = 0; shape < (int)(sizeof(SHAPE_NAMES) / sizeof(SHAPE_NAMES[0])); ++shape) {
+        if (strlen(SHAPE_NAMES[shape]) == name_length && strncmp(spec, SHAPE_NAMES[shape], name_length) == 0) {
+            return element_build((ElementShape)shape, size, element);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef STRUCTURING_ELEMENT_H
+#define STRUCTURING_ELEMENT_H
+
+#define ELEMENT_MIN_SIZE 3
+#define ELEMENT_MAX_SIZE 15
+#define ELEMENT_MAX_PASSES 16
+
+typedef enum {
+    SHAPE_DIAMOND,
+    SHAPE_SQUARE,
+    SHAPE_DISC,
+} ElementShape;
+
+// Elementary erosions an element is decomposed into. A 3x3 cross or square costs a fixed
+// handful of word operations per 64 pixels; a line of any length is a running AND, so its
+// cost does not grow with the length either.
+typedef enum {
+    PASS_CROSS,   // 3x3 cross
+    PASS_SQUARE,  // 3x3 square
+    PASS_ROWS,    // horizontal line of length pixels
+    PASS_COLUMNS, // vertical line of length pixels
+} PassKind;
+
+typedef struct {
+    PassKind kind;
+    int length;
+} ElementPass;
+
+// Centred, symmetric structuring element of odd size, stored as the sequence of passes that
+// erode by it one after the other. Squares are separable into a horizontal and a vertical
+// line. Diamonds are exact sums of 3x3 crosses, and discs are approximated by the octagon
+// that mixes 3x3 crosses and squares.
+typedef struct {
+    ElementShape shape;
+    int size;
+    int passes_amount;
+    ElementPass passes[ELEMENT_MAX_PASSES];
+} StructuringElement;
+
+// Parses "<shape>[:<size>]", shape being diamond, square or disc and size an odd number from
+// ELEMENT_MIN_SIZE to ELEMENT_MAX_SIZE (3 when left out). Returns 0 when spec is invalid.
+int element_parse(const char *spec, StructuringElement *element);
+
+// Builds the element of the given shape and size. Returns 0 when the size is not supported.
+int element_build(ElementShape shape, int size, StructuringElement *element);
+
+#endif
@@ -0,0 +1,114 @@
+#include "tile_pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct TilePool {
+    pthread_t *workers;
+    int workers_amount;
+    pthread_mutex_t lock;
+    pthread_cond_t started;
+    pthread_cond_t finished;
+
+    // The current run; generation changes with every run so workers see each one once
+    TileTask task;
+    void *argument;
+    int tasks;
+    int next;
+    int pending;
+    unsigned int generation;
+    int stop;
+};
+
+// Runs tasks of the current run until none are left. Called and returns with the lock held.
+static void work(TilePool *pool) {
+    while (pool->next < pool->tasks) {
+        int index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->argument, index);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->finished);
+        }
+    }
+}
+
+static void *worker_thread(void *argument) {
+    TilePool *pool = argument;
+    unsigned int seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->stop) {
+            pthread_cond_wait(&pool->started, &pool->lock);
+        }
+        if (pool->stop) break;
+        seen = pool->generation;
+        work(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+TilePool *tile_pool_start(int threads) {
+    TilePool *pool = calloc(1, sizeof(TilePool));
+    if (!pool || (threads > 1 && !(pool->workers = malloc((threads - 1) * sizeof(pthread_t))))) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for the tile pool\n");
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->started, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+
+    for (; pool->workers_amount < threads - 1; pool->workers_amount++) {
+        if (pthread_create(&pool->workers[pool->workers_amount], NULL, worker_thread, pool) != 0) {
+            fprintf(stderr, "[ERROR] Could not start the tile pool threads\n");
+            tile_pool_finish(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+int tile_pool_threads(const TilePool *pool) { return pool ? pool->workers_amount + 1 : 1; }
+
+void tile_pool_run(TilePool *pool, TileTask task, void *argument, int tasks) {
+    if (!pool || pool->workers_amount == 0 || tasks <= 1) {
+        for (int i = 0; i < tasks; ++i) {
+            task(argument, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->argument = argument;
+    pool->tasks = tasks;
+    pool->next = 0;
+    pool->pending = tasks;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->started);
+
+    work(pool);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void tile_pool_finish(TilePool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->started);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->workers_amount; ++i) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->started);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,24 @@
+#ifndef TILE_POOL_H
+#define TILE_POOL_H
+
+// Fork/join pool for splitting the work on one image over several threads. The calling
+// thread works along with the pool's threads and tile_pool_run returns once every task is
+// done, so each call is one parallel step with a barrier at the end.
+typedef struct TilePool TilePool;
+
+typedef void (*TileTask)(void *argument, int index);
+
+// Starts threads - 1 worker threads. Reports the problem and returns NULL when that fails.
+TilePool *tile_pool_start(int threads);
+
+// Number of threads working on a run, the caller included
+int tile_pool_threads(const TilePool *pool);
+
+// Calls task(argument, i) for every i in 0..tasks-1, spread over the threads. pool may be
+// NULL, the tasks then run in order on the calling thread.
+void tile_pool_run(TilePool *pool, TileTask task, void *argument, int tasks);
+
+// Stops the worker threads and frees the pool
+void tile_pool_finish(TilePool *pool);
+
+#endif
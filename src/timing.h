@@ -0,0 +1,31 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// TRACE_COUNT attaches a count to the span of the enclosing START_TIMER in trace builds
+#ifdef TIMING
+#define START_TIMER() clock_t timer_start = clock()
+#define END_TIMER(label)                                                                                                                             \
+    do {                                                                                                                                             \
+        clock_t timer_end = clock();                                                                                                                 \
+        double cpu_time = ((double)(timer_end - timer_start)) / CLOCKS_PER_SEC;                                                                      \
+        printf("[ %-5s ] %s took %.3f ms\n", "TIME", label, cpu_time * 1000.0);                                                                      \
+    } while (0)
+#define TRACE_COUNT(count, value)
+#elif defined(TRACE)
+#define START_TIMER()                                                                                                                                \
+    TraceSpan trace_span;                                                                                                                            \
+    trace_begin(&trace_span)
+#define END_TIMER(label) trace_end(&trace_span, label)
+#define TRACE_COUNT(count, value) trace_count(&trace_span, count, value)
+#else
+#define START_TIMER()
+#define END_TIMER(label)
+#define TRACE_COUNT(count, value)
+#endif
+
+#endif
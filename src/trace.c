@@ -0,0 +1,188 @@
+#include "trace.h"
+
+#ifdef TRACE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *COUNTER_NAMES[TRACE_COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static const unsigned long long COUNTER_CONFIGS[TRACE_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                                   PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+static const char *COUNT_NAMES[TRACE_COUNTS] = {"iteration", "pixels", "eroded", "components", "cells"};
+
+typedef enum { TRACE_CHROME, TRACE_CSV } TraceFormat;
+
+// Counters of one thread, opened by its first span. A counter the kernel or the hardware does
+// not offer keeps fd -1 and reads as -1, an empty column.
+typedef struct {
+    int fds[TRACE_COUNTERS];
+    int id;
+} ThreadCounters;
+
+static struct {
+    FILE *fp;
+    TraceFormat format;
+    int events;
+    long long epoch_ns;
+    int threads;
+    int warned;
+    pthread_key_t key;
+    pthread_mutex_t lock;
+} trace = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static long long now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+static void close_counters(void *argument) {
+    ThreadCounters *counters = argument;
+    for (int i = 0; i < TRACE_COUNTERS; i++) {
+        if (counters->fds[i] >= 0) close(counters->fds[i]);
+    }
+    free(counters);
+}
+
+// The counters of the calling thread, counting its user space work only
+static ThreadCounters *thread_counters(void) {
+    ThreadCounters *counters = pthread_getspecific(trace.key);
+    if (counters) return counters;
+
+    counters = malloc(sizeof(ThreadCounters));
+    if (!counters) return NULL;
+    pthread_mutex_lock(&trace.lock);
+    counters->id = ++trace.threads;
+    pthread_mutex_unlock(&trace.lock);
+    for (int i = 0; i < TRACE_COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = COUNTER_CONFIGS[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counters->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counters->fds[i] < 0 && !__atomic_exchange_n(&trace.warned, 1, __ATOMIC_RELAXED)) {
+            fprintf(stderr, "[ %-5s ] Hardware counter %s is not available (%s), its values are left out of the trace\n", "WARN",
+                    COUNTER_NAMES[i], strerror(errno));
+        }
+    }
+    pthread_setspecific(trace.key, counters);
+    return counters;
+}
+
+static void read_counters(ThreadCounters *counters, long long values[TRACE_COUNTERS]) {
+    for (int i = 0; i < TRACE_COUNTERS; i++) {
+        values[i] = -1;
+        if (counters && counters->fds[i] >= 0 && read(counters->fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+            values[i] = -1;
+        }
+    }
+}
+
+int trace_start(const char *path) {
+    trace.fp = fopen(path, "w");
+    if (!trace.fp) {
+        perror("Error creating trace file");
+        return 0;
+    }
+    size_t length = strlen(path);
+    trace.format = length > 4 && strcmp(path + length - 4, ".csv") == 0 ? TRACE_CSV : TRACE_CHROME;
+    trace.epoch_ns = now_ns();
+    pthread_key_create(&trace.key, close_counters);
+
+    if (trace.format == TRACE_CSV) {
+        fprintf(trace.fp, "stage,thread,start_us,duration_us");
+        for (int i = 0; i < TRACE_COUNTERS; i++) fprintf(trace.fp, ",%s", COUNTER_NAMES[i]);
+        for (int i = 0; i < TRACE_COUNTS; i++) fprintf(trace.fp, ",%s", COUNT_NAMES[i]);
+        fprintf(trace.fp, "\n");
+    } else {
+        fprintf(trace.fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    }
+    return 1;
+}
+
+void trace_finish(void) {
+    if (!trace.fp) return;
+    if (trace.format == TRACE_CHROME) fprintf(trace.fp, "\n]}\n");
+    fclose(trace.fp);
+    trace.fp = NULL;
+    // The counters of the calling thread; the other threads close theirs when they exit
+    ThreadCounters *counters = pthread_getspecific(trace.key);
+    if (counters) {
+        pthread_setspecific(trace.key, NULL);
+        close_counters(counters);
+    }
+}
+
+void trace_begin(TraceSpan *span) {
+    span->counts_set = 0;
+    if (!trace.fp) return;
+    read_counters(thread_counters(), span->counters);
+    span->start_ns = now_ns();
+}
+
+void trace_count(TraceSpan *span, TraceCount count, long long value) {
+    span->counts[count] = value;
+    span->counts_set |= 1u << count;
+}
+
+void trace_end(TraceSpan *span, const char *label) {
+    if (!trace.fp) return;
+    long long end_ns = now_ns();
+    ThreadCounters *counters = thread_counters();
+    long long counter_values[TRACE_COUNTERS];
+    read_counters(counters, counter_values);
+    for (int i = 0; i < TRACE_COUNTERS; i++) {
+        counter_values[i] = counter_values[i] >= 0 && span->counters[i] >= 0 ? counter_values[i] - span->counters[i] : -1;
+    }
+    double start_us = (span->start_ns - trace.epoch_ns) / 1000.0;
+    double duration_us = (end_ns - span->start_ns) / 1000.0;
+    int thread = counters ? counters->id : 0;
+
+    pthread_mutex_lock(&trace.lock);
+    if (trace.format == TRACE_CSV) {
+        fprintf(trace.fp, "%s,%d,%.3f,%.3f", label, thread, start_us, duration_us);
+        for (int i = 0; i < TRACE_COUNTERS; i++) {
+            if (counter_values[i] >= 0) {
+                fprintf(trace.fp, ",%lld", counter_values[i]);
+            } else {
+                fprintf(trace.fp, ",");
+            }
+        }
+        for (int i = 0; i < TRACE_COUNTS; i++) {
+            if (span->counts_set & (1u << i)) {
+                fprintf(trace.fp, ",%lld", span->counts[i]);
+            } else {
+                fprintf(trace.fp, ",");
+            }
+        }
+        fprintf(trace.fp, "\n");
+    } else {
+        // Complete events, one per span, with the counters and counts as arguments
+        fprintf(trace.fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{", trace.events ? ",\n" : "",
+                label, thread, start_us, duration_us);
+        const char *separator = "";
+        for (int i = 0; i < TRACE_COUNTERS; i++) {
+            if (counter_values[i] < 0) continue;
+            fprintf(trace.fp, "%s\"%s\":%lld", separator, COUNTER_NAMES[i], counter_values[i]);
+            separator = ",";
+        }
+        for (int i = 0; i < TRACE_COUNTS; i++) {
+            if (!(span->counts_set & (1u << i))) continue;
+            fprintf(trace.fp, "%s\"%s\":%lld", separator, COUNT_NAMES[i], span->counts[i]);
+            separator = ",";
+        }
+        fprintf(trace.fp, "}}");
+    }
+    trace.events++;
+    pthread_mutex_unlock(&trace.lock);
+}
+#endif
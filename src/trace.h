@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Tracing of the pipeline stages, built in with -DTRACE (make trace) and gone otherwise. Every
+// stage timed by START_TIMER/END_TIMER becomes a span with its wall time and the hardware
+// counters of the calling thread over it, read with perf_event_open, plus the counts the stage
+// attaches with TRACE_COUNT. trace_start picks the output by the file name: CSV for *.csv, a
+// Chrome trace (chrome://tracing, Perfetto) for anything else.
+
+// Hardware counters read around every span
+typedef enum { TRACE_CYCLES, TRACE_INSTRUCTIONS, TRACE_CACHE_MISSES, TRACE_BRANCH_MISSES, TRACE_COUNTERS } TraceCounter;
+
+// Counts a stage can attach to its span
+typedef enum {
+    TRACE_ITERATION,  // erosion step the stage belongs to
+    TRACE_PIXELS,     // pixels the stage went over
+    TRACE_ERODED,     // pixels the erosion step cleared
+    TRACE_COMPONENTS, // components labelled
+    TRACE_CELLS,      // cells found or drawn
+    TRACE_COUNTS
+} TraceCount;
+
+#define TRACE_DEFAULT_PATH "trace.json"
+
+// A stage being traced: when it started, the counters then and the counts attached so far
+typedef struct {
+    long long start_ns;
+    long long counters[TRACE_COUNTERS];
+    long long counts[TRACE_COUNTS];
+    unsigned int counts_set;
+} TraceSpan;
+
+#ifdef TRACE
+// Opens the trace file; spans before or without it are dropped. Returns 0 when it can not be
+// created. trace_finish completes and closes it.
+int trace_start(const char *path);
+void trace_finish(void);
+
+void trace_begin(TraceSpan *span);
+void trace_count(TraceSpan *span, TraceCount count, long long value);
+void trace_end(TraceSpan *span, const char *label);
+
+#define TRACE_START(path) trace_start(path)
+#define TRACE_FINISH() trace_finish()
+#else
+#define TRACE_START(path) 1
+#define TRACE_FINISH()
+#endif
+
+#endif
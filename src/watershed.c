@@ -1,125 +1,268 @@
-#include "cbmp.h"
-#include "priority_queue.h"
+#include "watershed.h"
+#include "timing.h"
+
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-void distance_transform(unsigned char input[BMP_WIDTH][BMP_HEIGHT], int distance[BMP_WIDTH][BMP_HEIGHT]) {
-    const int INF = BMP_WIDTH + BMP_HEIGHT;
-
-    // Initialize: background=0, foreground=INF
-    for (int x = 0; x < BMP_WIDTH; ++x) {
-        for (int y = 0; y < BMP_HEIGHT; ++y) {
-            distance[x][y] = (input[x][y] == WHITE) ? INF : 0;
+// Seeds must lie at least this far inside the foreground
+#define SEED_DISTANCE 5
+
+// How far a seed has to drop on every path to a higher maximum
+#define SEED_DYNAMICS 2
+
+// Regions below this many pixels are noise rather than cells
+#define MIN_CELL_SIZE 5
+
+// Mark local maxima before they are grouped into seeds
+#define MAXIMUM -2
+#define REJECTED -3
+
+#define AT(buffer, x, y) (buffer)[(y) * width + (x)]
+
+// Lower envelope of the parabolas (q - v)^2 + f[v] over the sites v in [start, end] with
+// finite f, sampled at every q in [start, end] (Felzenszwalb & Huttenlocher). f is overwritten
+// with the result; v, g and z hold the envelope's sites, their values and the boundaries.
+static void lower_envelope(unsigned int *f, int start, int end, int *v, unsigned int *g, double *z) {
+    int k = -1;
+    for (int q = start; q <= end; ++q) {
+        if (f[q] == DISTANCE_INF) continue;
+        double fq = (double)f[q] + (double)q * q;
+        double s = -HUGE_VAL;
+        while (k >= 0) {
+            s = (fq - ((double)g[k] + (double)v[k] * v[k])) / (2.0 * (q - v[k]));
+            if (s > z[k]) break;
+            k--;
         }
+        k++;
+        v[k] = q;
+        g[k] = f[q];
+        z[k] = k == 0 ? -HUGE_VAL : s;
+        z[k + 1] = HUGE_VAL;
     }
+    if (k < 0) return; // no site on this line, everything stays infinite
 
-    // Forward pass
-    for (int x = 0; x < BMP_WIDTH; ++x) {
-        for (int y = 0; y < BMP_HEIGHT; ++y) {
-            if (distance[x][y] == 0) continue;
+    for (int q = start, j = 0; q <= end; ++q) {
+        while (z[j + 1] < q) {
+            j++;
+        }
+        unsigned long long d = (unsigned long long)(q - v[j]) * (q - v[j]) + g[j];
+        f[q] = d < DISTANCE_INF ? (unsigned int)d : DISTANCE_INF - 1;
+    }
+}
 
-            int min_dist = distance[x][y];
+// Exact 1D transform of a line. A background pixel is closer to everything beyond it than any
+// site further out, so the envelope only needs building over the stretches between them.
+static void distance_1d(unsigned int *f, int n, int *v, unsigned int *g, double *z) {
+    int start = 0;
+    for (int q = 1; q <= n; ++q) {
+        if (q < n && f[q] != 0) continue;
+        int end = q < n ? q : n - 1;
+        if (end - start > 1 || f[start] != 0 || f[end] != 0) {
+            lower_envelope(f, start, end, v, g, z);
+        }
+        start = q;
+    }
+}
 
-            if (x > 0) {
-                min_dist = (distance[x - 1][y] + 1 < min_dist) ? distance[x - 1][y] + 1 : min_dist;
-            }
-            if (y > 0) {
-                min_dist = (distance[x][y - 1] + 1 < min_dist) ? distance[x][y - 1] + 1 : min_dist;
+unsigned int distance_transform(WatershedEngine *engine) {
+    START_TIMER();
+    BinaryImage *input = &engine->binary;
+    Distance *distance = engine->distance;
+    const int width = input->width;
+    const int height = input->height;
+    unsigned int *line = engine->line;
+    int *v = engine->sites;
+    unsigned int *g = engine->site_values;
+    double *z = engine->boundaries;
+
+    // Down every column: distance to the nearest background pixel of that column. All columns
+    // advance together a row at a time, so both sweeps run along contiguous rows. The first
+    // keeps the gap to the background above, the second the one below in line.
+    int background = 0;
+    for (int y = 0; y < height; ++y) {
+        const uint64_t *row = BINARY_ROW(input, y);
+        Distance *above = y > 0 ? &AT(distance, 0, y - 1) : NULL;
+        Distance *gaps = &AT(distance, 0, y);
+        for (int x = 0; x < width; ++x) {
+            if (!((row[x >> 6] >> (x & 63)) & 1)) {
+                gaps[x] = 0;
+                background = 1;
+            } else {
+                gaps[x] = above && above[x] != DISTANCE_INF ? above[x] + 1 : DISTANCE_INF;
             }
-            if (x > 0 && y > 0) {
-                min_dist = (distance[x - 1][y - 1] + 1 < min_dist) ? distance[x - 1][y - 1] + 1 : min_dist;
-            }
-            if (x < BMP_WIDTH - 1 && y > 0) {
-                min_dist = (distance[x + 1][y - 1] + 1 < min_dist) ? distance[x + 1][y - 1] + 1 : min_dist;
+        }
+    }
+    if (!background) {
+        END_TIMER("distance_transform");
+        return 0;
+    }
+    for (int x = 0; x < width; ++x) {
+        line[x] = DISTANCE_INF;
+    }
+    for (int y = height - 1; y >= 0; --y) {
+        Distance *gaps = &AT(distance, 0, y);
+        for (int x = 0; x < width; ++x) {
+            if (gaps[x] == 0) {
+                line[x] = 0;
+            } else if (line[x] != DISTANCE_INF) {
+                line[x]++;
             }
-
-            distance[x][y] = min_dist;
+            unsigned int nearest = gaps[x] < line[x] ? gaps[x] : line[x];
+            gaps[x] = nearest == DISTANCE_INF ? DISTANCE_INF : (nearest * nearest < DISTANCE_INF ? nearest * nearest : DISTANCE_INF - 1);
         }
     }
 
-    // Backward pass
-    for (int x = BMP_WIDTH - 1; x >= 0; --x) {
-        for (int y = BMP_HEIGHT - 1; y >= 0; --y) {
-            if (distance[x][y] == 0) continue;
-
-            int min_dist = distance[x][y];
+    // Across every row, in place through the line buffer
+    unsigned int max_distance = 0;
+    for (int y = 0; y < height; ++y) {
+        Distance *row = &AT(distance, 0, y);
+        for (int x = 0; x < width; ++x) {
+            line[x] = row[x];
+        }
+        distance_1d(line, width, v, g, z);
+        for (int x = 0; x < width; ++x) {
+            unsigned int value = line[x];
+            row[x] = value;
+            if (value > max_distance) max_distance = value;
+        }
+    }
+    END_TIMER("distance_transform");
+    return max_distance;
+}
 
-            if (x < BMP_WIDTH - 1) {
-                min_dist = (distance[x + 1][y] + 1 < min_dist) ? distance[x + 1][y] + 1 : min_dist;
-            }
-            if (y < BMP_HEIGHT - 1) {
-                min_dist = (distance[x][y + 1] + 1 < min_dist) ? distance[x][y + 1] + 1 : min_dist;
-            }
-            if (x < BMP_WIDTH - 1 && y < BMP_HEIGHT - 1) {
-                min_dist = (distance[x + 1][y + 1] + 1 < min_dist) ? distance[x + 1][y + 1] + 1 : min_dist;
-            }
-            if (x > 0 && y < BMP_HEIGHT - 1) {
-                min_dist = (distance[x - 1][y + 1] + 1 < min_dist) ? distance[x - 1][y + 1] + 1 : min_dist;
+// Gives the 8-connected pixels labelled from, and inside the foreground, the label to instead
+static void flood_label(Distance *distance, int *labels, int *stack, int width, int height, int start, int from, int to) {
+    int size = 0;
+    stack[size++] = start;
+    labels[start] = to;
+    while (size > 0) {
+        int pixel = stack[--size];
+        int x = pixel % width;
+        int y = pixel / width;
+        for (int nx = x - 1; nx <= x + 1; ++nx) {
+            for (int ny = y - 1; ny <= y + 1; ++ny) {
+                if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                if (AT(labels, nx, ny) != from || AT(distance, nx, ny) == 0) continue;
+                AT(labels, nx, ny) = to;
+                stack[size++] = ny * width + nx;
             }
+        }
+    }
+}
 
-            distance[x][y] = min_dist;
+// Whether the plateau at start stands out: it may not reach a higher pixel, or an earlier
+// plateau of the same height, without first dropping by SEED_DYNAMICS. Even exact Euclidean
+// distances have a ridge of shallow maxima along the medial axis of an elongated cell, split
+// further by pixel noise on its outline; this leaves one seed per cell.
+static int is_seed(WatershedEngine *engine, int width, int height, int start) {
+    Distance *distance = engine->distance;
+    int *labels = engine->labels;
+    int *stack = engine->stack;
+    unsigned int *visited = engine->visited;
+    const unsigned int stamp = ++engine->stamp;
+    const unsigned int peak = distance[start];
+    const int label = labels[start];
+
+    // Distances are squared, the drop is not
+    double root = sqrt((double)peak) - SEED_DYNAMICS;
+    const unsigned int limit = root > 0 ? (unsigned int)(root * root) : 0;
+
+    int size = 0;
+    stack[size++] = start;
+    visited[start] = stamp;
+    while (size > 0) {
+        int pixel = stack[--size];
+        int x = pixel % width;
+        int y = pixel / width;
+        for (int nx = x - 1; nx <= x + 1; ++nx) {
+            for (int ny = y - 1; ny <= y + 1; ++ny) {
+                if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                int neighbour = ny * width + nx;
+                if (visited[neighbour] == stamp || distance[neighbour] <= limit) continue;
+                if (distance[neighbour] > peak) return 0;
+                if (distance[neighbour] == peak && labels[neighbour] != label && labels[neighbour] != MAXIMUM) return 0;
+                visited[neighbour] = stamp;
+                stack[size++] = neighbour;
+            }
         }
     }
+    return 1;
 }
 
-void find_local_maxima(int distance[BMP_WIDTH][BMP_HEIGHT], int labels[BMP_WIDTH][BMP_HEIGHT], int *labels_amount) {
+int find_local_maxima(WatershedEngine *engine, int width, int height) {
+    Distance *distance = engine->distance;
+    int *labels = engine->labels;
     int current_label = 0;
+    int dx[8] = {-1, 1, 0, 0, -1, -1, 1, 1};
+    int dy[8] = {0, 0, -1, 1, -1, 1, -1, 1};
 
     // Initialize labels
-    for (int x = 0; x < BMP_WIDTH; ++x) {
-        for (int y = 0; y < BMP_HEIGHT; ++y) {
-            labels[x][y] = 0;
-        }
-    }
+    memset(labels, 0, (size_t)width * height * sizeof(int));
 
     // Find local maxima (centers of cells)
-    for (int x = 0; x < BMP_WIDTH; ++x) {
-        for (int y = 0; y < BMP_HEIGHT; ++y) {
-            if (distance[x][y] <= 1) continue; // Skip background and edges
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            if (AT(distance, x, y) < SEED_DISTANCE * SEED_DISTANCE) continue; // Skip background and shallow pixels
 
             int is_maximum = 1;
-            int dx[8] = {-1, 1, 0, 0, -1, -1, 1, 1};
-            int dy[8] = {0, 0, -1, 1, -1, 1, -1, 1};
-
             for (int i = 0; i < 8; ++i) {
                 int nx = x + dx[i];
                 int ny = y + dy[i];
-                if (nx >= 0 && nx < BMP_WIDTH && ny >= 0 && ny < BMP_HEIGHT) {
-                    if (distance[nx][ny] > distance[x][y]) {
+                if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
+                    if (AT(distance, nx, ny) > AT(distance, x, y)) {
                         is_maximum = 0;
                         break;
                     }
                 }
             }
 
-            if (is_maximum && distance[x][y] >= 7) { // Minimum distance threshold
-                current_label++;
-                labels[x][y] = current_label;
+            if (is_maximum) {
+                AT(labels, x, y) = MAXIMUM;
+            }
+        }
+    }
+
+    // Plateaus of equal distance are one candidate, kept when it stands out from its surroundings
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            if (AT(labels, x, y) != MAXIMUM) continue;
+            int start = y * width + x;
+            flood_label(distance, labels, engine->stack, width, height, start, MAXIMUM, ++current_label);
+            if (!is_seed(engine, width, height, start)) {
+                flood_label(distance, labels, engine->stack, width, height, start, current_label, REJECTED);
+                current_label--;
             }
         }
     }
 
-    *labels_amount = current_label;
-    printf("[ DEBUG ] Local maxima found: %d\n", current_label);
+    // Rejected plateaus are flooded like any other pixel
+    size_t pixel_amount = (size_t)width * height;
+    for (size_t i = 0; i < pixel_amount; ++i) {
+        if (labels[i] == REJECTED) labels[i] = UNLABELED;
+    }
+
+    return current_label;
 }
 
-void watershed_segmentation(int distance[BMP_WIDTH][BMP_HEIGHT], int labels[BMP_WIDTH][BMP_HEIGHT]) {
-    int num_labels;
-    find_local_maxima(distance, labels, &num_labels);
+void watershed_segmentation(WatershedEngine *engine, int width, int height) {
+    START_TIMER();
+    Distance *distance = engine->distance;
+    int *labels = engine->labels;
+    BucketQueue *queue = &engine->queue;
 
-    if (num_labels == 0) {
-        printf("[ DEBUG ] No seeds found\n");
-        return;
+    // Squared distances are small integers, so they are the levels directly
+    if (!bucket_queue_reserve(queue, (size_t)width * height, engine->max_distance)) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for watershed queue\n");
+        exit(1);
     }
 
-    PriorityQueue *pq = priority_queue_create(BMP_WIDTH * BMP_HEIGHT);
-    if (!pq) return;
-
-    // Add all seed pixels to queue with NEGATIVE priority (for max-heap behavior)
-    for (int x = 0; x < BMP_WIDTH; x++) {
-        for (int y = 0; y < BMP_HEIGHT; y++) {
-            if (labels[x][y] > 0) {
-                priority_queue_push(pq, x, y, -distance[x][y]);
+    // Add all seed pixels to the queue, highest distance is flooded first
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (AT(labels, x, y) > 0) {
+                bucket_queue_push(queue, y * width + x, AT(distance, x, y));
             }
         }
     }
@@ -128,27 +271,27 @@ void watershed_segmentation(int distance[BMP_WIDTH][BMP_HEIGHT], int labels[BMP_
     int dy[8] = {0, 0, -1, 1, -1, 1, -1, 1};
 
     // Process queue from high distance to low distance
-    while (!priority_queue_is_empty(pq)) {
-        QueueNode node = priority_queue_pop(pq);
-        int x = node.x;
-        int y = node.y;
-        int current_label = labels[x][y];
+    while (!bucket_queue_is_empty(queue)) {
+        int pixel = bucket_queue_pop(queue);
+        int x = pixel % width;
+        int y = pixel / width;
+        int current_label = AT(labels, x, y);
 
         // Process neighbors
         for (int i = 0; i < 8; i++) {
             int nx = x + dx[i];
             int ny = y + dy[i];
 
-            if (nx >= 0 && nx < BMP_WIDTH && ny >= 0 && ny < BMP_HEIGHT) {
+            if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
                 // Only process unlabeled foreground pixels
-                if (labels[nx][ny] == 0 && distance[nx][ny] > 0) {
+                if (AT(labels, nx, ny) == UNLABELED && AT(distance, nx, ny) > 0) {
                     // Check for watershed line
                     int has_different_neighbor = 0;
                     for (int j = 0; j < 8; j++) {
                         int nnx = nx + dx[j];
                         int nny = ny + dy[j];
-                        if (nnx >= 0 && nnx < BMP_WIDTH && nny >= 0 && nny < BMP_HEIGHT) {
-                            if (labels[nnx][nny] > 0 && labels[nnx][nny] != WATERSHED_LINE && labels[nnx][nny] != current_label) {
+                        if (nnx >= 0 && nnx < width && nny >= 0 && nny < height) {
+                            if (AT(labels, nnx, nny) > 0 && AT(labels, nnx, nny) != current_label) {
                                 has_different_neighbor = 1;
                                 break;
                             }
@@ -156,48 +299,172 @@ void watershed_segmentation(int distance[BMP_WIDTH][BMP_HEIGHT], int labels[BMP_
                     }
 
                     if (has_different_neighbor) {
-                        labels[nx][ny] = WATERSHED_LINE;
+                        AT(labels, nx, ny) = WATERSHED_LINE;
                     } else {
-                        labels[nx][ny] = current_label;
-                        priority_queue_push(pq, nx, ny, -distance[nx][ny]);
+                        AT(labels, nx, ny) = current_label;
+                        bucket_queue_push(queue, ny * width + nx, AT(distance, nx, ny));
                     }
                 }
             }
         }
     }
+    END_TIMER("watershed_segmentation");
+}
 
-    priority_queue_free(pq);
+BinaryImage *watershed_begin(WatershedEngine *engine, int width, int height) {
+    if (!binary_reserve(&engine->binary, width, height)) return NULL;
+
+    size_t pixel_amount = (size_t)width * height;
+    if (pixel_amount > engine->capacity) {
+        free(engine->distance);
+        free(engine->labels);
+        free(engine->stack);
+        free(engine->visited);
+        engine->distance = malloc(pixel_amount * sizeof(Distance));
+        engine->labels = malloc(pixel_amount * sizeof(int));
+        engine->stack = malloc(pixel_amount * sizeof(int));
+        engine->visited = malloc(pixel_amount * sizeof(unsigned int));
+        engine->capacity = (engine->distance && engine->labels && engine->stack && engine->visited) ? pixel_amount : 0;
+        if (!engine->capacity) return NULL;
+    }
+    memset(engine->visited, 0, pixel_amount * sizeof(unsigned int));
+    engine->stamp = 0;
+
+    // The line buffer holds one row, the envelope needs one more slot
+    if ((size_t)width > engine->line_capacity || width + 1 > engine->sites_capacity) {
+        free(engine->line);
+        free(engine->sites);
+        free(engine->site_values);
+        free(engine->boundaries);
+        engine->line = malloc(width * sizeof(unsigned int));
+        engine->sites = malloc((width + 1) * sizeof(int));
+        engine->site_values = malloc((width + 1) * sizeof(unsigned int));
+        engine->boundaries = malloc((width + 2) * sizeof(double));
+        int allocated = engine->line && engine->sites && engine->site_values && engine->boundaries;
+        engine->line_capacity = allocated ? width : 0;
+        engine->sites_capacity = allocated ? width + 1 : 0;
+        if (!allocated) return NULL;
+    }
+    engine->spots_amount = 0;
+    return &engine->binary;
 }
 
-int watershed_erode(unsigned char input[BMP_WIDTH][BMP_HEIGHT], unsigned char output[BMP_WIDTH][BMP_HEIGHT]) {
-    static int distance[BMP_WIDTH][BMP_HEIGHT];
-    static int labels[BMP_WIDTH][BMP_HEIGHT];
-    int eroded_any = 0;
+static void reserve_labels(WatershedEngine *engine, int labels_amount) {
+    if (labels_amount + 1 <= engine->labels_capacity) return;
+    int capacity = engine->labels_capacity ? engine->labels_capacity : 1024;
+    while (capacity < labels_amount + 1) {
+        capacity *= 2;
+    }
+    free(engine->area);
+    free(engine->first);
+    free(engine->sum_x);
+    free(engine->sum_y);
+    engine->area = malloc(capacity * sizeof(int));
+    engine->first = malloc(capacity * sizeof(int));
+    engine->sum_x = malloc(capacity * sizeof(long long));
+    engine->sum_y = malloc(capacity * sizeof(long long));
+    if (!engine->area || !engine->first || !engine->sum_x || !engine->sum_y) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for watershed labels\n");
+        exit(1);
+    }
+    engine->labels_capacity = capacity;
+}
+
+static void push_cell(WatershedEngine *engine, int x, int y, int area, int first) {
+    if (engine->spots_amount == engine->spots_capacity) {
+        int capacity = engine->spots_capacity ? engine->spots_capacity * 2 : 256;
+        Spot *grown = realloc(engine->spots, capacity * sizeof(Spot));
+        if (!grown) {
+            fprintf(stderr, "[ERROR] Could not allocate memory for cells\n");
+            exit(1);
+        }
+        engine->spots = grown;
+        engine->spots_capacity = capacity;
+    }
+    Spot *spot = &engine->spots[engine->spots_amount++];
+    spot->center.x = x;
+    spot->center.y = y;
+    spot->area = area;
+    spot->first = first;
+}
 
-    // Copy input to output initially
-    memcpy(output, input, BMP_WIDTH * BMP_HEIGHT);
+static int compare_cells(const void *a, const void *b) { return ((const Spot *)a)->first - ((const Spot *)b)->first; }
 
-    distance_transform(input, distance);
-    watershed_segmentation(distance, labels);
+int watershed_count(WatershedEngine *engine) {
+    const int width = engine->binary.width;
+    const int height = engine->binary.height;
+    Distance *distance = engine->distance;
+    int *labels = engine->labels;
 
-    // Apply watershed lines as erosion
-    for (int x = 0; x < BMP_WIDTH; ++x) {
-        for (int y = 0; y < BMP_HEIGHT; ++y) {
-            if (labels[x][y] == WATERSHED_LINE) {
-                output[x][y] = 128; // Erode watershed lines
-                eroded_any = 1;
+    // Without background there is nothing to measure depth from or to split cells along; the
+    // whole image is one region, far larger than any cell
+    engine->max_distance = distance_transform(engine);
+    if (engine->max_distance == 0) {
+        engine->spots_amount = 0;
+        return 0;
+    }
+    int labels_amount = find_local_maxima(engine, width, height);
+    watershed_segmentation(engine, width, height);
+
+    // Foreground the flood did not reach has no seed deep enough, each such component is one cell
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            if (AT(labels, x, y) == UNLABELED && AT(distance, x, y) > 0) {
+                flood_label(distance, labels, engine->stack, width, height, y * width + x, UNLABELED, ++labels_amount);
             }
         }
     }
 
-    // Debug info
-    int watershed_count = 0;
-    for (int x = 0; x < BMP_WIDTH; ++x) {
-        for (int y = 0; y < BMP_HEIGHT; ++y) {
-            if (labels[x][y] == WATERSHED_LINE) watershed_count++;
+    // Area, centroid and first pixel in column order of every region in one scan
+    reserve_labels(engine, labels_amount);
+    memset(engine->area, 0, (labels_amount + 1) * sizeof(int));
+    memset(engine->sum_x, 0, (labels_amount + 1) * sizeof(long long));
+    memset(engine->sum_y, 0, (labels_amount + 1) * sizeof(long long));
+    int *order = engine->stack;
+    int order_amount = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int label = AT(labels, x, y);
+            if (label <= 0) continue;
+            if (engine->area[label]++ == 0) {
+                engine->first[label] = x * height + y;
+                order[order_amount++] = label;
+            } else if (x * height + y < engine->first[label]) {
+                engine->first[label] = x * height + y;
+            }
+            engine->sum_x[label] += x;
+            engine->sum_y[label] += y;
         }
     }
-    printf("[ DEBUG ] Watershed lines: %d pixels\n", watershed_count);
 
-    return eroded_any;
+    engine->spots_amount = 0;
+    for (int i = 0; i < order_amount; ++i) {
+        int label = order[i];
+        int area = engine->area[label];
+        if (area < MIN_CELL_SIZE) continue;
+        push_cell(engine, (int)(engine->sum_x[label] / area), (int)(engine->sum_y[label] / area), area, engine->first[label]);
+    }
+
+    // Report cells in column order, like the erosion engine
+    if (engine->spots_amount > 1) qsort(engine->spots, engine->spots_amount, sizeof(Spot), compare_cells);
+    return engine->spots_amount;
+}
+
+void watershed_free(WatershedEngine *engine) {
+    binary_free(&engine->binary);
+    free(engine->distance);
+    free(engine->labels);
+    free(engine->stack);
+    free(engine->visited);
+    free(engine->line);
+    free(engine->sites);
+    free(engine->site_values);
+    free(engine->boundaries);
+    bucket_queue_free(&engine->queue);
+    free(engine->area);
+    free(engine->first);
+    free(engine->sum_x);
+    free(engine->sum_y);
+    free(engine->spots);
+    memset(engine, 0, sizeof(*engine));
 }
@@ -1,21 +1,82 @@
 #ifndef WATERSHED_H
 #define WATERSHED_H
 
-#include "cbmp.h"
+#include "binary_image.h"
+#include "bucket_queue.h"
+#include "erosion.h"
+
+#include <limits.h>
+
 #define UNLABELED 0
-#define WATERSHED_LINE 254
-#define MINIMA_BUFFER_SIZE (BMP_WIDTH * BMP_HEIGHT)
+#define WATERSHED_LINE -1
+
+// Squared Euclidean distances to the background. Building with -DDISTANCE_16BIT halves the
+// distance plane; distances beyond 255 pixels then saturate, far above any cell radius.
+#ifdef DISTANCE_16BIT
+typedef uint16_t Distance;
+#define DISTANCE_INF UINT16_MAX
+#else
+typedef unsigned int Distance;
+#define DISTANCE_INF UINT_MAX
+#endif
+
+// Watershed segmentation engine: distance transform of the foreground, one seed per
+// plateau of local maxima, then a flood from the seeds that splits touching cells along
+// watershed lines. Every resulting region is a cell. Buffers are reused between images.
+typedef struct {
+    BinaryImage binary;
+
+    // One value per pixel, indexed [y * width + x] like Image
+    Distance *distance;
+    unsigned int max_distance;
+    int *labels;
+    int *stack;
+    unsigned int *visited;
+    unsigned int stamp;
+    size_t capacity;
+
+    // Scratch for the distance transform: one row, and the lower envelope
+    unsigned int *line;
+    size_t line_capacity;
+    int *sites;
+    unsigned int *site_values;
+    double *boundaries;
+    int sites_capacity;
+
+    BucketQueue queue;
+
+    // Per label, grown with the number of labels
+    int *area;
+    int *first;
+    long long *sum_x;
+    long long *sum_y;
+    int labels_capacity;
+
+    // Cells found by the last watershed_count, in column order of their first pixel
+    Spot *spots;
+    int spots_amount;
+    int spots_capacity;
+} WatershedEngine;
+
+// Exact squared Euclidean distance transform of engine->binary into engine->distance, in
+// two separable linear passes. Returns the largest distance, or 0 when the image has no
+// background to measure from, in which case the distances are left undefined.
+unsigned int distance_transform(WatershedEngine *engine);
+
+// Labels every prominent plateau of local maxima deep enough inside the foreground with its
+// own seed label and returns the number of seeds
+int find_local_maxima(WatershedEngine *engine, int width, int height);
 
-void distance_transform(unsigned char input[BMP_WIDTH][BMP_HEIGHT],
-                        int distance[BMP_WIDTH][BMP_HEIGHT]);
+// Floods the foreground from the labelled seeds, highest distance first
+void watershed_segmentation(WatershedEngine *engine, int width, int height);
 
-void find_regional_minima(int distance[BMP_WIDTH][BMP_HEIGHT],
-                          int labels[BMP_WIDTH][BMP_HEIGHT], int *num_labels);
+// Prepares the engine for a width x height image and returns the binary image the thresholded
+// image must be written to before watershed_count is called. Returns NULL on allocation failure.
+BinaryImage *watershed_begin(WatershedEngine *engine, int width, int height);
 
-void watershed_segmentation(int distance[BMP_WIDTH][BMP_HEIGHT],
-                            int labels[BMP_WIDTH][BMP_HEIGHT]);
+// Segments the binary image and stores the centroids in engine->spots. Returns the number of cells.
+int watershed_count(WatershedEngine *engine);
 
-int watershed_erode(unsigned char input[BMP_WIDTH][BMP_HEIGHT],
-                    unsigned char output[BMP_WIDTH][BMP_HEIGHT]);
+void watershed_free(WatershedEngine *engine);
 
 #endif
@@ -0,0 +1,569 @@
+#include "batch.h"
+#include "pipeline.h"
+#include "stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Regression test over the samples corpus, run in-process by make test. Every sample goes through
+// the pipeline serially, split over a tile pool and streamed in strips much smaller than the
+// image with the smallest halo. The cell count must match the golden data exactly, every centroid
+// must have a partner within the tolerance, and the annotated image must match the reference in
+// sample_outputs/ pixel for pixel. The watershed engine and larger structuring elements are
+// checked against golden data of their own, the report of one sample against a recorded file per
+// format, uniform images against the cells they must give, and the threshold of a histogram
+// against the same histogram scaled up to whole-slide sizes. With --record the golden data and
+// reports are written from the current results instead.
+
+#define GOLDEN_PATH "tests/golden.txt"
+#define SAMPLES_PATH "samples"
+#define REFERENCE_PATH "sample_outputs"
+#define CENTROID_TOLERANCE 2
+#define POOL_THREADS 4
+#define PATH_BUFFER 4096
+#define STREAM_TEST_STRIP_ROWS 128
+#define UNIFORM_SIZE 64
+#define REPORTS_PATH "tests/reports"
+#define REPORT_SAMPLE "samples/easy/1EASY.bmp"
+
+static const char *TIERS[] = {"easy", "medium", "hard", "impossible"};
+#define TIERS_AMOUNT (int)(sizeof(TIERS) / sizeof(TIERS[0]))
+
+// Recorded results of one sample, named by its path below SAMPLES_PATH
+typedef struct {
+    char name[PATH_BUFFER];
+    Coordinates *centroids;
+    int amount;
+} Golden;
+
+typedef struct {
+    Golden *entries;
+    int amount;
+    int capacity;
+} GoldenData;
+
+// Pipeline configurations other than the default, checked serially against golden data
+// recorded under "<label>/<sample name>"
+typedef struct {
+    const char *label;
+    Engine engine;
+    const char *element;
+} Variant;
+
+static const Variant VARIANTS[] = {
+    {"watershed", ENGINE_WATERSHED, "diamond:3"},
+    {"square-5", ENGINE_ERODE, "square:5"},
+    {"disc-9", ENGINE_ERODE, "disc:9"},
+};
+#define VARIANTS_AMOUNT (int)(sizeof(VARIANTS) / sizeof(VARIANTS[0]))
+
+// Report formats with the extension of their recorded file in REPORTS_PATH
+typedef struct {
+    ReportFormat format;
+    const char *extension;
+} RecordedReport;
+
+static const RecordedReport REPORTS[] = {
+    {FORMAT_TEXT, "txt"},
+    {FORMAT_JSON, "json"},
+    {FORMAT_CSV, "csv"},
+    {FORMAT_BINARY, "bin"},
+};
+#define REPORTS_AMOUNT (int)(sizeof(REPORTS) / sizeof(REPORTS[0]))
+
+// An image of a single grey level and the cells an engine must find in it
+typedef struct {
+    unsigned char level;
+    Engine engine;
+    int cells;
+} Uniform;
+
+// Nothing but background, and nothing but foreground: the erosion shrinks the latter down to a
+// single spot, the watershed has no background to measure depth from and finds no cell
+static const Uniform UNIFORMS[] = {
+    {BLACK, ENGINE_ERODE, 0},
+    {BLACK, ENGINE_WATERSHED, 0},
+    {WHITE, ENGINE_ERODE, 1},
+    {WHITE, ENGINE_WATERSHED, 0},
+};
+#define UNIFORMS_AMOUNT (int)(sizeof(UNIFORMS) / sizeof(UNIFORMS[0]))
+
+// Sides of the square images REPORT_SAMPLE's histogram is scaled up to, up to the whole-slide
+// sizes --stream is for, where 32-bit pixel counts and sums would wrap
+static const int THRESHOLD_SIDES[] = {4096, 8192, 16384, 40000, 65536};
+#define THRESHOLD_SIDES_AMOUNT (int)(sizeof(THRESHOLD_SIDES) / sizeof(THRESHOLD_SIDES[0]))
+
+static void usage(char *program) {
+    fprintf(stderr, "Usage: %s [--record] [--tolerance N]\n", program);
+    exit(1);
+}
+
+static void *grow(void *items, int *capacity, size_t item_size) {
+    *capacity = *capacity ? *capacity * 2 : 64;
+    void *grown = realloc(items, *capacity * item_size);
+    if (!grown) {
+        fprintf(stderr, "[ERROR] Could not allocate memory for the golden data\n");
+        exit(1);
+    }
+    return grown;
+}
+
+// Golden file: a "sample <name> <cells>" line per sample followed by one "x y" line per centroid
+static int load_golden(const char *path, GoldenData *data) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("Error opening golden data");
+        return 0;
+    }
+    char line[PATH_BUFFER];
+    Golden *golden = NULL;
+    int capacity = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        int cells;
+        Coordinates centroid;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (strncmp(line, "sample ", 7) == 0) {
+            if (data->amount == data->capacity) data->entries = grow(data->entries, &data->capacity, sizeof(Golden));
+            golden = &data->entries[data->amount++];
+            memset(golden, 0, sizeof(*golden));
+            capacity = 0;
+            if (sscanf(line + 7, "%4095s %d", golden->name, &cells) != 2) break;
+        } else if (golden && sscanf(line, "%d %d", &centroid.x, &centroid.y) == 2) {
+            if (golden->amount == capacity) golden->centroids = grow(golden->centroids, &capacity, sizeof(Coordinates));
+            golden->centroids[golden->amount++] = centroid;
+        } else {
+            break;
+        }
+    }
+    int complete = feof(fp);
+    fclose(fp);
+    if (!complete) fprintf(stderr, "[ERROR] Malformed golden data in %s: %s", path, line);
+    return complete;
+}
+
+static const Golden *find_golden(const GoldenData *data, const char *name) {
+    for (int i = 0; i < data->amount; ++i) {
+        if (strcmp(data->entries[i].name, name) == 0) return &data->entries[i];
+    }
+    return NULL;
+}
+
+// Pairs every golden centroid with an unused found one at most tolerance away on both axes.
+// Returns the number left without a partner.
+static int unmatched_centroids(const Golden *golden, const Coordinates *found, int found_amount, int tolerance) {
+    unsigned char *used = calloc(found_amount + 1, 1);
+    int unmatched = 0;
+    for (int i = 0; i < golden->amount; ++i) {
+        int match = -1;
+        for (int j = 0; j < found_amount && match < 0; ++j) {
+            if (!used[j] && abs(found[j].x - golden->centroids[i].x) <= tolerance && abs(found[j].y - golden->centroids[i].y) <= tolerance) {
+                match = j;
+            }
+        }
+        if (match < 0) {
+            unmatched++;
+        } else {
+            used[match] = 1;
+        }
+    }
+    free(used);
+    return unmatched;
+}
+
+// Number of pixels of image that differ from the reference, or -1 when the sizes differ
+static long differing_pixels(const Image *image, const Image *reference) {
+    if (image->width != reference->width || image->height != reference->height) return -1;
+    long differing = 0;
+    for (int y = 0; y < image->height; ++y) {
+        const unsigned char *row = IMAGE_ROW(image, y);
+        const unsigned char *reference_row = IMAGE_ROW(reference, y);
+        for (int x = 0; x < image->width * BMP_CHANNELS; x += BMP_CHANNELS) {
+            differing += memcmp(row + x, reference_row + x, BMP_CHANNELS) != 0;
+        }
+    }
+    return differing;
+}
+
+// Counts the bytes that differ between two files, or returns -1 if their sizes differ or either
+// cannot be read
+static long differing_bytes(const char *path, const char *reference_path) {
+    FILE *fp = fopen(path, "rb");
+    FILE *reference_fp = fopen(reference_path, "rb");
+    long differing = fp && reference_fp ? 0 : -1;
+    while (differing >= 0) {
+        int byte = fgetc(fp);
+        int reference_byte = fgetc(reference_fp);
+        if ((byte == EOF) != (reference_byte == EOF)) {
+            differing = -1;
+        } else if (byte == EOF) {
+            break;
+        } else {
+            differing += byte != reference_byte;
+        }
+    }
+    if (fp) fclose(fp);
+    if (reference_fp) fclose(reference_fp);
+    return differing;
+}
+
+// Runs the pipeline on one sample, writing the annotated image to output_path unless it is NULL,
+// and leaves the centroids in pipeline
+static void run_sample(Pipeline *pipeline, char *path, char *output_path) {
+    BMP *bmp = open_bitmap(path);
+    if (!bmp) exit(1);
+    pipeline_decode(pipeline, bmp);
+    pipeline_segment(pipeline, pipeline_threshold(pipeline));
+    if (output_path) {
+        pipeline_annotate(pipeline);
+        write_painted_bitmap(bmp, pipeline->paint, output_path);
+    }
+    bclose(bmp);
+}
+
+// Streams one sample with the smallest halo, which many windows have to grow, writing the
+// annotated image to output_path
+static void stream_sample(Pipeline *pipeline, char *path, char *output_path) {
+    StreamOptions options = {.strip_rows = STREAM_TEST_STRIP_ROWS, .halo_rows = stream_min_halo(&pipeline->element)};
+    unsigned int threshold;
+    stream_segment(pipeline, path, output_path, &options, &threshold);
+}
+
+// Checks the count and centroids of one run against the golden data. Returns the number of failures.
+static int check_centroids(const Pipeline *pipeline, const char *name, const char *mode, const Golden *golden, int tolerance) {
+    if (!golden) {
+        printf("[ %-5s ] %s (%s): no golden data, run make golden\n", "FAIL", name, mode);
+        return 1;
+    }
+    int failures = 0;
+    if (pipeline->coordinates_amount != golden->amount) {
+        printf("[ %-5s ] %s (%s): %d cells, expected %d\n", "FAIL", name, mode, pipeline->coordinates_amount, golden->amount);
+        failures++;
+    }
+    int unmatched = unmatched_centroids(golden, pipeline->coordinates, pipeline->coordinates_amount, tolerance);
+    if (unmatched) {
+        printf("[ %-5s ] %s (%s): %d of %d centroids moved more than %d pixels\n", "FAIL", name, mode, unmatched, golden->amount, tolerance);
+        failures++;
+    }
+    return failures;
+}
+
+// Checks one run against the golden data, and the annotated image it wrote to output_path against
+// the reference image. Returns the number of failures.
+static int check_sample(const Pipeline *pipeline, const char *name, const char *mode, const Golden *golden, char *output_path,
+                        const Image *reference, int tolerance) {
+    int failures = check_centroids(pipeline, name, mode, golden, tolerance);
+    Image annotated = {0};
+    BMP *annotated_template = NULL;
+    read_bitmap(output_path, &annotated, &annotated_template);
+    long differing = differing_pixels(&annotated, reference);
+    image_free(&annotated);
+    bclose(annotated_template);
+    if (differing != 0) {
+        if (differing < 0) {
+            printf("[ %-5s ] %s (%s): output size differs from the reference image\n", "FAIL", name, mode);
+        } else {
+            printf("[ %-5s ] %s (%s): %ld pixels differ from the reference image\n", "FAIL", name, mode, differing);
+        }
+        failures++;
+    }
+    return failures;
+}
+
+// Writes a size x size 24-bit bitmap of a single grey level to path
+static void write_uniform(const char *path, int size, unsigned char level) {
+    const int row_size = (size * 3 + 3) & ~3;
+    const int pixels_size = row_size * size;
+    unsigned char header[54] = {'B', 'M'};
+    const int fields[][2] = {{2, 54 + pixels_size}, {10, 54}, {14, 40}, {18, size}, {22, size}, {26, 1}, {28, 24}, {34, pixels_size}};
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+        for (int byte = 0; byte < 4; ++byte) {
+            header[fields[i][0] + byte] = (fields[i][1] >> (byte * 8)) & 0xFF;
+        }
+    }
+    unsigned char *pixels = calloc(pixels_size, 1);
+    FILE *fp = fopen(path, "wb");
+    if (!pixels || !fp) {
+        fprintf(stderr, "[ERROR] Could not write the uniform image\n");
+        exit(1);
+    }
+    for (int y = 0; y < size; ++y) {
+        memset(pixels + (size_t)y * row_size, level, size * 3);
+    }
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(pixels, 1, pixels_size, fp);
+    fclose(fp);
+    free(pixels);
+}
+
+// Runs every engine on the uniform images. Returns the number of failures.
+static int check_uniforms(char *input_path) {
+    int failures = 0;
+    for (int i = 0; i < UNIFORMS_AMOUNT; ++i) {
+        const Uniform *uniform = &UNIFORMS[i];
+        const char *engine = uniform->engine == ENGINE_ERODE ? "erode" : "watershed";
+        Pipeline pipeline = {.engine = uniform->engine};
+        write_uniform(input_path, UNIFORM_SIZE, uniform->level);
+        run_sample(&pipeline, input_path, NULL);
+        if (pipeline.coordinates_amount != uniform->cells) {
+            printf("[ %-5s ] uniform %d (%s): %d cells, expected %d\n", "FAIL", uniform->level, engine, pipeline.coordinates_amount,
+                   uniform->cells);
+            failures++;
+        } else {
+            printf("[ %-5s ] uniform %d (%s): %d cells\n", "PASS", uniform->level, engine, uniform->cells);
+        }
+        pipeline_free(&pipeline);
+    }
+    return failures;
+}
+
+// Scales the histogram of REPORT_SAMPLE up to every side in THRESHOLD_SIDES, which must not change
+// its threshold. Returns the number of failures.
+static int check_threshold_scaling(void) {
+    Pipeline pipeline = {0};
+    BMP *bmp = open_bitmap(REPORT_SAMPLE);
+    if (!bmp) exit(1);
+    pipeline_decode(&pipeline, bmp);
+    bclose(bmp);
+    uint64_t counts[256];
+    histogram_total(&pipeline.histogram, counts);
+    const uint64_t total = (uint64_t)pipeline.greyscale_image.width * pipeline.greyscale_image.height;
+    const unsigned int threshold = otsu_threshold(counts, total);
+    pipeline_free(&pipeline);
+
+    int failures = 0;
+    for (int i = 0; i < THRESHOLD_SIDES_AMOUNT; ++i) {
+        const uint64_t scale = (uint64_t)THRESHOLD_SIDES[i] * THRESHOLD_SIDES[i] / total;
+        uint64_t scaled[256];
+        for (int v = 0; v < 256; ++v) {
+            scaled[v] = counts[v] * scale;
+        }
+        unsigned int scaled_threshold = otsu_threshold(scaled, total * scale);
+        if (scaled_threshold != threshold) {
+            printf("[ %-5s ] %s: threshold %u scaled to %dx%d, expected %u\n", "FAIL", REPORT_SAMPLE, scaled_threshold, THRESHOLD_SIDES[i],
+                   THRESHOLD_SIDES[i], threshold);
+            failures++;
+        }
+    }
+    if (!failures) {
+        printf("[ %-5s ] %s: threshold %u at every scale up to %dx%d\n", "PASS", REPORT_SAMPLE, threshold,
+               THRESHOLD_SIDES[THRESHOLD_SIDES_AMOUNT - 1], THRESHOLD_SIDES[THRESHOLD_SIDES_AMOUNT - 1]);
+    }
+    return failures;
+}
+
+// Reports REPORT_SAMPLE in every format and compares each with its recorded file, or records
+// it. Returns the number of failures.
+static int check_reports(int record) {
+    Pipeline pipeline = {0};
+    BMP *bmp = open_bitmap(REPORT_SAMPLE);
+    if (!bmp) exit(1);
+    pipeline_decode(&pipeline, bmp);
+    unsigned int threshold = pipeline_threshold(&pipeline);
+    pipeline_segment(&pipeline, threshold);
+    bclose(bmp);
+    ImageReport report = {.path = REPORT_SAMPLE,
+                          .threshold = threshold,
+                          .cells = pipeline.coordinates_amount,
+                          .coordinates = pipeline.coordinates,
+                          .areas = pipeline.areas,
+                          .iterations = pipeline.iterations};
+
+    int failures = 0;
+    for (int i = 0; i < REPORTS_AMOUNT; ++i) {
+        ReportOptions options = {.format = REPORTS[i].format};
+        report_image(&pipeline.report, &options, &report);
+        const ReportBuffer *rendered = &pipeline.report;
+        char path[PATH_BUFFER];
+        snprintf(path, sizeof(path), "%s/report.%s", REPORTS_PATH, REPORTS[i].extension);
+
+        FILE *fp = fopen(path, record ? "wb" : "rb");
+        if (!fp) {
+            printf("[ %-5s ] %s: could not open %s, run make golden\n", "FAIL", REPORT_SAMPLE, path);
+            failures++;
+            continue;
+        }
+        if (record) {
+            fwrite(rendered->data, 1, rendered->length, fp);
+            fclose(fp);
+            continue;
+        }
+        char *recorded = malloc(rendered->length + 1);
+        size_t length = recorded ? fread(recorded, 1, rendered->length + 1, fp) : 0;
+        fclose(fp);
+        if (length != rendered->length || memcmp(recorded, rendered->data, length) != 0) {
+            printf("[ %-5s ] %s: %s report differs from %s\n", "FAIL", REPORT_SAMPLE, REPORTS[i].extension, path);
+            failures++;
+        } else {
+            printf("[ %-5s ] %s: %s report\n", "PASS", REPORT_SAMPLE, REPORTS[i].extension);
+        }
+        free(recorded);
+    }
+    pipeline_free(&pipeline);
+    return failures;
+}
+
+static void record_sample(FILE *fp, const Pipeline *pipeline, const char *name) {
+    fprintf(fp, "sample %s %d\n", name, pipeline->coordinates_amount);
+    for (int i = 0; i < pipeline->coordinates_amount; ++i) {
+        fprintf(fp, "%d %d\n", pipeline->coordinates[i].x, pipeline->coordinates[i].y);
+    }
+}
+
+int main(int argc, char **argv) {
+    int record = FALSE;
+    int tolerance = CENTROID_TOLERANCE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0) {
+            record = TRUE;
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    GoldenData golden_data = {0};
+    FILE *record_fp = NULL;
+    if (record) {
+        record_fp = fopen(GOLDEN_PATH, "w");
+        if (!record_fp) {
+            perror("Error opening golden data");
+            return 1;
+        }
+        fprintf(record_fp, "# Golden results of the default pipeline and its variants, written by make golden\n");
+    } else if (!load_golden(GOLDEN_PATH, &golden_data)) {
+        return 1;
+    }
+
+    Pipeline serial = {0};
+    Pipeline tiled = {.pool = tile_pool_start(POOL_THREADS)};
+    if (!tiled.pool) return 1;
+    Pipeline streamed = {0};
+    element_build(SHAPE_DIAMOND, 3, &streamed.element);
+    Pipeline variants[VARIANTS_AMOUNT];
+    for (int v = 0; v < VARIANTS_AMOUNT; ++v) {
+        variants[v] = (Pipeline){.engine = VARIANTS[v].engine};
+        element_parse(VARIANTS[v].element, &variants[v].element);
+    }
+    char output_path[] = "/tmp/cell-counter-test-XXXXXX";
+    int output_fd = mkstemp(output_path);
+    if (output_fd < 0) {
+        perror("Error creating the annotated image");
+        return 1;
+    }
+    close(output_fd);
+    char stream_path[] = "/tmp/cell-counter-stream-XXXXXX";
+    int stream_fd = mkstemp(stream_path);
+    if (stream_fd < 0) {
+        perror("Error creating the streamed image");
+        return 1;
+    }
+    close(stream_fd);
+    Image reference = {0};
+    BMP *reference_template = NULL;
+    int samples = 0;
+    int failures = 0;
+
+    for (int t = 0; t < TIERS_AMOUNT; ++t) {
+        char directory[PATH_BUFFER];
+        snprintf(directory, sizeof(directory), "%s/%s", SAMPLES_PATH, TIERS[t]);
+        BatchList list = {0};
+        if (!batch_collect(directory, &list)) return 1;
+
+        for (int i = 0; i < list.amount; ++i) {
+            const char *name = list.paths[i] + strlen(SAMPLES_PATH) + 1;
+            samples++;
+            run_sample(&serial, list.paths[i], output_path);
+            if (record) {
+                record_sample(record_fp, &serial, name);
+            }
+            int sample_failures = 0;
+            for (int v = 0; v < VARIANTS_AMOUNT; ++v) {
+                char variant_name[PATH_BUFFER];
+                snprintf(variant_name, sizeof(variant_name), "%s/%s", VARIANTS[v].label, name);
+                run_sample(&variants[v], list.paths[i], NULL);
+                if (record) {
+                    record_sample(record_fp, &variants[v], variant_name);
+                } else {
+                    sample_failures += check_centroids(&variants[v], name, VARIANTS[v].label, find_golden(&golden_data, variant_name), tolerance);
+                }
+            }
+            if (record) continue;
+
+            const Golden *golden = find_golden(&golden_data, name);
+            if (!golden) {
+                printf("[ %-5s ] %s: no golden data, run make golden\n", "FAIL", name);
+                failures += sample_failures + 1;
+                continue;
+            }
+            char reference_path[PATH_BUFFER];
+            snprintf(directory, sizeof(directory), "%s/%s", REFERENCE_PATH, TIERS[t]);
+            batch_output_path(list.paths[i], directory, reference_path, sizeof(reference_path));
+            read_bitmap(reference_path, &reference, &reference_template);
+
+            sample_failures += check_sample(&serial, name, "serial", golden, output_path, &reference, tolerance);
+            run_sample(&tiled, list.paths[i], output_path);
+            sample_failures += check_sample(&tiled, name, "tiled", golden, output_path, &reference, tolerance);
+            stream_sample(&streamed, list.paths[i], stream_path);
+            sample_failures += check_sample(&streamed, name, "streamed", golden, stream_path, &reference, tolerance);
+            long differing = differing_bytes(stream_path, output_path);
+            if (differing != 0) {
+                if (differing < 0) {
+                    printf("[ %-5s ] %s (streamed): annotated image size differs from the in-memory one\n", "FAIL", name);
+                } else {
+                    printf("[ %-5s ] %s (streamed): annotated image differs from the in-memory one in %ld bytes\n", "FAIL", name, differing);
+                }
+                sample_failures++;
+            }
+            if (!sample_failures) {
+                printf("[ %-5s ] %s: %d cells\n", "PASS", name, golden->amount);
+            }
+            failures += sample_failures;
+        }
+        batch_free(&list);
+    }
+
+    failures += check_reports(record);
+    if (!record) {
+        char uniform_path[] = "/tmp/cell-counter-uniform-XXXXXX";
+        int uniform_fd = mkstemp(uniform_path);
+        if (uniform_fd < 0) {
+            perror("Error creating the uniform image");
+            return 1;
+        }
+        close(uniform_fd);
+        failures += check_uniforms(uniform_path);
+        remove(uniform_path);
+        failures += check_threshold_scaling();
+    }
+
+    if (record) {
+        fclose(record_fp);
+        printf("Recorded %d samples to %s\n", samples, GOLDEN_PATH);
+    } else if (failures) {
+        printf("%d checks FAILED over %d samples\n", failures, samples);
+    } else {
+        printf("All %d samples match the golden data and reference images\n", samples);
+    }
+
+    for (int i = 0; i < golden_data.amount; ++i) {
+        free(golden_data.entries[i].centroids);
+    }
+    free(golden_data.entries);
+    image_free(&reference);
+    if (reference_template) {
+        bclose(reference_template);
+    }
+    tile_pool_finish(tiled.pool);
+    pipeline_free(&serial);
+    pipeline_free(&tiled);
+    pipeline_free(&streamed);
+    for (int v = 0; v < VARIANTS_AMOUNT; ++v) {
+        pipeline_free(&variants[v]);
+    }
+    remove(output_path);
+    remove(stream_path);
+    return failures ? 1 : 0;
+}